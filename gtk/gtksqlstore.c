@@ -1,4 +1,7 @@
 #include <gtk/gtksqlstore.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 struct _GtkSqlStorePrivate
@@ -12,12 +15,161 @@ struct _GtkSqlStorePrivate
 
 	gint n_columns;
 	gchar **columns;
+
+	/* declared schema, NULL types and no flags for untyped tables */
+	gchar **sql_types;
+	GtkSqlStoreColumnFlags *column_flags;
+	GtkSqlStoreTableFlags table_flags;
+
+	/* cache column of the "fetched" flag of deferred columns, or -1 */
+	gint *fetched_columns;
+	sqlite3_stmt **fetch_stmts;
+
+	/* cache column of the still compressed value, or -1 */
+	gint *compressed_columns;
+
+	/* GtkSqlStoreDisplay, exposed as model columns after n_columns; the
+	 * cache columns point into display_strings, emptied with the cache */
+	GArray *displays;
+	GStringChunk *display_strings;
+	guint n_display_strings;
+
+	/* set instead of table for read-only stores over a SELECT */
+	sqlite3_stmt *query_stmt;
+
+	/* attached shard databases, NULL for a single table */
+	GArray *shards;
+	gint next_shard;
+	gint write_shard;
+	gint shard_cache_column;
+	gint shard_sort_column;
+
+	/* polling for rows appended past follow_rowid */
+	guint follow_source;
+	gint follow_max_rows;
+	gint64 follow_rowid;
+	gboolean follow_valid;
+
+	/* unique column upserts are keyed on, or -1 */
+	gint key_column;
+
+	/* persisted sort key, cached in a hidden column */
+	gchar *order_column;
+	gint order_cache_column;
+	gboolean drag_moved;
+
+	/* the first load waits for the first access */
+	gboolean needs_load;
+	gint load_threads;
+
+	/* database state the cache was loaded from */
+	gboolean loaded;
+	gint64 data_version;
+	gint64 schema_version;
+	gint total_changes;
 };
 
+typedef struct
+{
+	GtkTreeIter iter;
+	gint index;
+	gint64 rowid;
+	gint shard;
+} GtkSqlStoreRow;
+
+typedef struct
+{
+	gint id;
+	gchar *filename;
+} GtkSqlStoreShard;
+
+typedef struct
+{
+	gint column;
+	gint cache_column;
+	gchar *format;
+	GtkSqlStoreDisplayFunc func;
+	gpointer user_data;
+	GDestroyNotify destroy;
+} GtkSqlStoreDisplay;
+
 static void gtk_sql_store_tree_model_init(GtkTreeModelIface *iface);
+static void gtk_sql_store_drag_source_init(GtkTreeDragSourceIface *iface);
+static void gtk_sql_store_drag_dest_init(GtkTreeDragDestIface *iface);
 static void gtk_sql_store_finalize(GObject *object);
 
-static void gtk_sql_store_ensure_table_exists(GtkSqlStore *sql_store);
+static void gtk_sql_store_init_columns(GtkSqlStore *sql_store,
+                                       gint n_columns,
+                                       const gchar **columns,
+                                       GType *types);
+static gboolean gtk_sql_store_check_writable(GtkSqlStore *sql_store);
+static void gtk_sql_store_ensure_loaded(GtkSqlStore *sql_store);
+static void gtk_sql_store_load(GtkSqlStore *sql_store);
+static void gtk_sql_store_clear_cache(GtkSqlStore *sql_store);
+static void gtk_sql_store_announce_rows(GtkSqlStore *sql_store);
+static gboolean gtk_sql_store_requery_parallel(GtkSqlStore *sql_store);
+static gint gtk_sql_store_append_selection(GtkSqlStore *sql_store,
+                                          GString *sql,
+                                          gint *insert_columns);
+static void gtk_sql_store_fetch_deferred(GtkSqlStore *sql_store,
+                                         GtkTreeIter *iter,
+                                         gint column);
+static void gtk_sql_store_values_changed(GtkSqlStore *sql_store,
+                                         GtkTreeIter *iter,
+                                         gint *columns,
+                                         gint n_values);
+static void gtk_sql_store_rebuild_cache(GtkSqlStore *sql_store);
+static void gtk_sql_store_get_display_value(GtkSqlStore *sql_store,
+                                            GtkTreeIter *iter,
+                                            gint index,
+                                            GValue *value);
+static void gtk_sql_store_ensure_table_exists(GtkSqlStore *sql_store,
+                                              gint shard);
+static gchar *gtk_sql_store_table_name(GtkSqlStore *sql_store,
+                                       gint shard);
+static gint gtk_sql_store_n_tables(GtkSqlStore *sql_store);
+static gint gtk_sql_store_nth_table(GtkSqlStore *sql_store,
+                                    gint n);
+static gint64 gtk_sql_store_query_pragma(GtkSqlStore *sql_store,
+                                         const gchar *pragma);
+static gboolean gtk_sql_store_requery_shards(GtkSqlStore *sql_store);
+static void gtk_sql_store_ensure_index(GtkSqlStore *sql_store,
+                                       gint shard,
+                                       const gchar *column,
+                                       gboolean unique);
+static void gtk_sql_store_move(GtkSqlStore *sql_store,
+                               GtkTreeIter *iter,
+                               gint dest_index);
+static gboolean gtk_sql_store_is_current(GtkSqlStore *sql_store);
+static void gtk_sql_store_sync_changes(GtkSqlStore *sql_store,
+                                       gint changes_before,
+                                       gint n_changed);
+static gboolean gtk_sql_store_exec(GtkSqlStore *sql_store,
+                                   const gchar *sql);
+static void gtk_sql_store_remove_cached_rows(GtkSqlStore *sql_store,
+                                             gint shard,
+                                             GArray *rowids);
+static void gtk_sql_store_set_cached_values(GtkSqlStore *sql_store,
+                                            GtkTreeIter *iter,
+                                            gint *columns,
+                                            GValue *values,
+                                            gint n_values);
+static void gtk_sql_store_update_cached_rows(GtkSqlStore *sql_store,
+                                             gint shard,
+                                             GArray *rowids,
+                                             gint *columns,
+                                             GValue *values,
+                                             gint n_values);
+static gint compare_rowids(gconstpointer a, gconstpointer b);
+static gdouble gtk_sql_store_next_order_key(GtkSqlStore *sql_store);
+static void gtk_sql_store_append_cached_row(GtkSqlStore *sql_store,
+                                            GtkTreeIter *iter,
+                                            gint64 rowid,
+                                            gint *columns,
+                                            GValue *values,
+                                            gint n_values,
+                                            gdouble order_key);
+static void bind_sql_param(sqlite3_stmt *stmt, int col, GValue *value);
 
 /* TreeModel interface */
 static GtkTreeModelFlags gtk_sql_store_get_flags(GtkTreeModel *tree_model);
@@ -56,9 +208,30 @@ static void gtk_sql_store_ref_node(GtkTreeModel *tree_model,
 static void gtk_sql_store_unref_node(GtkTreeModel *tree_model,
                                      GtkTreeIter *iter);
 
+/* TreeDragSource interface */
+static gboolean gtk_sql_store_row_draggable(GtkTreeDragSource *drag_source,
+                                            GtkTreePath *path);
+static gboolean gtk_sql_store_drag_data_get(GtkTreeDragSource *drag_source,
+                                            GtkTreePath *path,
+                                            GtkSelectionData *selection_data);
+static gboolean gtk_sql_store_drag_data_delete(GtkTreeDragSource *drag_source,
+                                               GtkTreePath *path);
+
+/* TreeDragDest interface */
+static gboolean gtk_sql_store_drag_data_received(GtkTreeDragDest *drag_dest,
+                                                 GtkTreePath *dest_path,
+                                                 GtkSelectionData *selection_data);
+static gboolean gtk_sql_store_row_drop_possible(GtkTreeDragDest *drag_dest,
+                                                GtkTreePath *dest_path,
+                                                GtkSelectionData *selection_data);
+
 G_DEFINE_TYPE_WITH_CODE(GtkSqlStore, gtk_sql_store, G_TYPE_OBJECT,
 		G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
-			gtk_sql_store_tree_model_init))
+			gtk_sql_store_tree_model_init)
+		G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_DRAG_SOURCE,
+			gtk_sql_store_drag_source_init)
+		G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_DRAG_DEST,
+			gtk_sql_store_drag_dest_init))
 
 static void gtk_sql_store_class_init(GtkSqlStoreClass *class)
 {
@@ -90,9 +263,24 @@ static void gtk_sql_store_tree_model_init(GtkTreeModelIface *iface)
 	iface->unref_node = gtk_sql_store_unref_node;
 }
 
+static void gtk_sql_store_drag_source_init(GtkTreeDragSourceIface *iface)
+{
+	iface->row_draggable = gtk_sql_store_row_draggable;
+	iface->drag_data_get = gtk_sql_store_drag_data_get;
+	iface->drag_data_delete = gtk_sql_store_drag_data_delete;
+}
+
+static void gtk_sql_store_drag_dest_init(GtkTreeDragDestIface *iface)
+{
+	iface->drag_data_received = gtk_sql_store_drag_data_received;
+	iface->row_drop_possible = gtk_sql_store_row_drop_possible;
+}
+
 static void gtk_sql_store_init(GtkSqlStore *sql_store)
 {
 	sql_store->priv = G_TYPE_INSTANCE_GET_PRIVATE(sql_store, GTK_TYPE_SQL_STORE, GtkSqlStorePrivate);
+	sql_store->priv->displays = g_array_new(FALSE, FALSE, sizeof(GtkSqlStoreDisplay));
+	sql_store->priv->display_strings = g_string_chunk_new(4096);
 }
 
 static void gtk_sql_store_finalize(GObject *object)
@@ -101,13 +289,41 @@ static void gtk_sql_store_finalize(GObject *object)
 	GtkSqlStorePrivate *priv = sql_store->priv;
 	int i;
 
+	if (priv->follow_source != 0)
+		g_source_remove(priv->follow_source);
 	g_object_unref(priv->store);
+	/* open statements would keep sqlite3_close() from closing */
+	sqlite3_finalize(priv->query_stmt);
+	for (i = 0; i < priv->n_columns; ++i)
+		sqlite3_finalize(priv->fetch_stmts[i]);
 	if (priv->should_close_db)
 		sqlite3_close(priv->db);
 	g_free(priv->table);
-	for (i = 0; i < priv->n_columns; ++i)
+	g_free(priv->order_column);
+	if (priv->shards != NULL) {
+		for (i = 0; i < (int)priv->shards->len; ++i)
+			g_free(g_array_index(priv->shards, GtkSqlStoreShard, i).filename);
+		g_array_free(priv->shards, TRUE);
+	}
+	for (i = 0; i < priv->n_columns; ++i) {
 		g_free(priv->columns[i]);
+		g_free(priv->sql_types[i]);
+	}
 	g_free(priv->columns);
+	g_free(priv->sql_types);
+	g_free(priv->column_flags);
+	g_free(priv->fetched_columns);
+	g_free(priv->compressed_columns);
+	g_free(priv->fetch_stmts);
+	for (i = 0; i < (int)priv->displays->len; ++i) {
+		GtkSqlStoreDisplay *display = &g_array_index(priv->displays, GtkSqlStoreDisplay, i);
+
+		g_free(display->format);
+		if (display->destroy != NULL)
+			display->destroy(display->user_data);
+	}
+	g_array_free(priv->displays, TRUE);
+	g_string_chunk_free(priv->display_strings);
 
 	G_OBJECT_CLASS(gtk_sql_store_parent_class)->finalize(object);
 }
@@ -144,6 +360,132 @@ static void read_sql_column(GValue *value, sqlite3_stmt *stmt, int col)
 	}
 }
 
+/* compressed values are stored as a BLOB starting with a marker byte,
+ * plain values that happen to start with one get an escape byte; only
+ * text is compressed, a legacy TEXT value never starts with 0x00 and
+ * one starting with 0x01 is only taken for zlib data if a valid stream
+ * header follows */
+#define COMPRESSED_MARKER 0x01
+#define ESCAPED_MARKER 0x00
+#define COMPRESS_MIN_SIZE 512
+
+/* runs data through converter, which is consumed, after an optional
+ * marker byte (-1 for none) */
+static GBytes *convert_bytes(GConverter *converter,
+                             gint marker,
+                             gconstpointer data,
+                             gsize size)
+{
+	GOutputStream *mem = g_memory_output_stream_new_resizable();
+	GOutputStream *out;
+	GBytes *bytes = NULL;
+	guint8 marker_byte = marker;
+	gboolean ok = TRUE;
+
+	if (marker >= 0)
+		ok = g_output_stream_write_all(mem, &marker_byte, 1, NULL, NULL, NULL);
+
+	out = g_converter_output_stream_new(mem, converter);
+	ok = ok && g_output_stream_write_all(out, data, size, NULL, NULL, NULL);
+	ok = g_output_stream_close(out, NULL, NULL) && ok;
+	if (ok)
+		bytes = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(mem));
+
+	g_object_unref(out);
+	g_object_unref(mem);
+	g_object_unref(converter);
+
+	return bytes;
+}
+
+static void read_compressed_value(GValue *value, gconstpointer data, gsize size)
+{
+	const guint8 *bytes = data;
+	GBytes *plain;
+
+	if (size > 2 && bytes[0] == COMPRESSED_MARKER &&
+	    bytes[1] == 0x78 && (bytes[1] * 256 + bytes[2]) % 31 == 0) {
+		plain = convert_bytes(G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB)),
+			-1, bytes + 1, size - 1);
+		if (plain == NULL) {
+			g_warning("cannot decompress column value");
+			return;
+		}
+	} else if (size > 0 && bytes[0] == ESCAPED_MARKER) {
+		plain = g_bytes_new(bytes + 1, size - 1);
+	} else {
+		plain = g_bytes_new(bytes, size);
+	}
+
+	if (G_VALUE_HOLDS_STRING(value)) {
+		gsize len;
+		gconstpointer text = g_bytes_get_data(plain, &len);
+
+		g_value_take_string(value, g_strndup(text, len));
+		g_bytes_unref(plain);
+	} else {
+		g_value_take_boxed(value, plain);
+	}
+}
+
+static void bind_compressed_param(sqlite3_stmt *stmt, int col, GValue *value)
+{
+	const guint8 *data;
+	gsize size;
+	GBytes *bytes;
+
+	if (G_VALUE_HOLDS_STRING(value)) {
+		data = (const guint8 *)g_value_get_string(value);
+		size = data != NULL ? strlen((const gchar *)data) : 0;
+	} else {
+		bytes = g_value_get_boxed(value);
+		data = bytes != NULL ? g_bytes_get_data(bytes, &size) : NULL;
+	}
+
+	if (data == NULL) {
+		sqlite3_bind_null(stmt, col);
+		return;
+	}
+
+	if (size >= COMPRESS_MIN_SIZE) {
+		bytes = convert_bytes(G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1)),
+			COMPRESSED_MARKER, data, size);
+		if (bytes != NULL && g_bytes_get_size(bytes) < size) {
+			sqlite3_bind_blob(stmt, col,
+				g_bytes_get_data(bytes, NULL),
+				g_bytes_get_size(bytes),
+				SQLITE_TRANSIENT);
+			g_bytes_unref(bytes);
+			return;
+		}
+		if (bytes != NULL)
+			g_bytes_unref(bytes);
+	}
+
+	if (size > 0 && (data[0] == COMPRESSED_MARKER || data[0] == ESCAPED_MARKER)) {
+		guint8 *escaped = g_malloc(size + 1);
+
+		escaped[0] = ESCAPED_MARKER;
+		memcpy(escaped + 1, data, size);
+		sqlite3_bind_blob(stmt, col, escaped, size + 1, g_free);
+		return;
+	}
+
+	bind_sql_param(stmt, col, value);
+}
+
+static void bind_column_param(GtkSqlStore *sql_store,
+                              sqlite3_stmt *stmt,
+                              int col,
+                              gint column,
+                              GValue *value)
+{
+	if (sql_store->priv->compressed_columns[column] >= 0)
+		bind_compressed_param(stmt, col, value);
+	else
+		bind_sql_param(stmt, col, value);
+}
+
 static void bind_sql_param(sqlite3_stmt *stmt, int col, GValue *value)
 {
 	if (G_VALUE_HOLDS_STRING(value)) {
@@ -165,6 +507,24 @@ static void bind_sql_param(sqlite3_stmt *stmt, int col, GValue *value)
 	}
 }
 
+static gint64 query_pragma_int64(sqlite3 *db, const gchar *pragma)
+{
+	gchar *sql;
+	sqlite3_stmt *stmt;
+	gint64 result = -1;
+
+	sql = g_strdup_printf("PRAGMA %s;", pragma);
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK &&
+	    sqlite3_step(stmt) == SQLITE_ROW)
+		result = sqlite3_column_int64(stmt, 0);
+	else
+		g_warning("SQLite error: %s", sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	g_free(sql);
+
+	return result;
+}
+
 static GValue arg_to_value(va_list *ap, GType type)
 {
 	GValue value = G_VALUE_INIT;
@@ -231,29 +591,19 @@ GtkSqlStore *gtk_sql_store_newv(sqlite3 *db,
 {
 	GtkSqlStore *sql_store;
 	GtkSqlStorePrivate *priv;
-	GType *sub_types;
-	int i;
 
 	g_warn_if_fail(n_columns > 0);
 
 	sql_store = g_object_new(gtk_sql_store_get_type(), NULL);
 	priv = sql_store->priv;
 
-	sub_types = g_malloc((1 + n_columns) * sizeof(GType));
-	sub_types[0] = G_TYPE_INT64;
-	memcpy(sub_types + 1, types, n_columns * sizeof(GType));
-
-	priv->store = gtk_list_store_newv(1 + n_columns, sub_types);
 	priv->db = db;
 	priv->should_close_db = FALSE;
 	priv->table = g_strdup(table);
-	priv->n_columns = n_columns;
-	priv->columns = g_malloc(n_columns * sizeof(gchar *));
-	for (i = 0; i < n_columns; ++i)
-		priv->columns[i] = g_strdup(columns[i]);
+	gtk_sql_store_init_columns(sql_store, n_columns, columns, types);
+	priv->needs_load = TRUE;
 
-	gtk_sql_store_ensure_table_exists(sql_store);
-	gtk_sql_store_requery(sql_store);
+	gtk_sql_store_ensure_table_exists(sql_store, -1);
 
 	return sql_store;
 }
@@ -296,8 +646,6 @@ GtkSqlStore *gtk_sql_store_new_with_filev(const gchar *filename,
 	sqlite3 *db;
 	GtkSqlStore *sql_store;
 	GtkSqlStorePrivate *priv;
-	GType *sub_types;
-	int i;
 
 	g_warn_if_fail(n_columns > 0);
 
@@ -310,408 +658,3653 @@ GtkSqlStore *gtk_sql_store_new_with_filev(const gchar *filename,
 	sql_store = g_object_new(gtk_sql_store_get_type(), NULL);
 	priv = sql_store->priv;
 
-	sub_types = g_malloc((1 + n_columns) * sizeof(GType));
-	sub_types[0] = G_TYPE_INT64;
-	memcpy(sub_types + 1, types, n_columns * sizeof(GType));
-
-	priv->store = gtk_list_store_newv(1 + n_columns, sub_types);
 	priv->db = db;
 	priv->should_close_db = TRUE;
 	priv->table = g_strdup(table);
-	priv->n_columns = n_columns;
-	priv->columns = g_malloc(n_columns * sizeof(gchar *));
-	for (i = 0; i < n_columns; ++i)
-		priv->columns[i] = g_strdup(columns[i]);
+	gtk_sql_store_init_columns(sql_store, n_columns, columns, types);
+	priv->needs_load = TRUE;
 
-	gtk_sql_store_ensure_table_exists(sql_store);
-	gtk_sql_store_requery(sql_store);
+	gtk_sql_store_ensure_table_exists(sql_store, -1);
 
 	return sql_store;
 }
 
-static void gtk_sql_store_ensure_table_exists(GtkSqlStore *sql_store)
+static const gchar *sql_type_from_gtype(GType type, gboolean strict)
 {
-	GtkSqlStorePrivate *priv = sql_store->priv;
-	GString *sql;
-	int i;
-
-	sql = g_string_new("CREATE TABLE IF NOT EXISTS ");
-	g_string_append_printf(sql, "\"%s\" (", priv->table);
-	for (i = 0; i < priv->n_columns; ++i) {
-		if (i != 0)
-			g_string_append_printf(sql, ", ");
-		g_string_append_printf(sql, "\"%s\"", priv->columns[i]);
-	}
-	g_string_append_printf(sql, ");");
-
-	if (sqlite3_exec(priv->db, sql->str, NULL, NULL, NULL) != SQLITE_OK) {
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	switch (G_TYPE_FUNDAMENTAL(type)) {
+	case G_TYPE_BOOLEAN:
+	case G_TYPE_INT:
+	case G_TYPE_UINT:
+	case G_TYPE_INT64:
+	case G_TYPE_UINT64:
+		return "INTEGER";
+	case G_TYPE_FLOAT:
+	case G_TYPE_DOUBLE:
+		return "REAL";
+	case G_TYPE_STRING:
+		return "TEXT";
+	default:
+		if (type == G_TYPE_BYTES)
+			return "BLOB";
+		/* no declared type keeps BLOB affinity outside STRICT tables */
+		return strict ? "ANY" : "";
 	}
-
-	g_string_free(sql, TRUE);
 }
 
-void gtk_sql_store_requery(GtkSqlStore *sql_store)
+static void gtk_sql_store_init_column_specs(GtkSqlStore *sql_store,
+                                            GtkSqlStoreTableFlags flags,
+                                            gint n_columns,
+                                            const GtkSqlStoreColumn *specs)
 {
 	GtkSqlStorePrivate *priv = sql_store->priv;
-	gchar *column_selection;
-	gchar *sql;
-	sqlite3_stmt *stmt;
-	int n_cols;
-	gint *insert_columns;
-	GValue *insert_values;
+	const gchar **columns;
+	GType *types;
 	int i;
-	int ret;
 
-	{
-		GString *cols = g_string_new("_ROWID_");
-		for (i = 0; i < priv->n_columns; ++i)
-			g_string_append_printf(cols, ", \"%s\"", priv->columns[i]);
-		column_selection = g_string_free(cols, FALSE);
+	columns = g_malloc(n_columns * sizeof(const gchar *));
+	types = g_malloc(n_columns * sizeof(GType));
+	for (i = 0; i < n_columns; ++i) {
+		columns[i] = specs[i].name;
+		types[i] = specs[i].type;
 	}
 
-	sql = g_strdup_printf("SELECT %s FROM \"%s\";", column_selection, priv->table);
-	g_free(column_selection);
-
-	ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
-	g_free(sql);
-
-	if (ret != SQLITE_OK) {
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
-		sqlite3_finalize(stmt);
-		return;
-	}
+	gtk_sql_store_init_columns(sql_store, n_columns, columns, types);
 
-	n_cols = sqlite3_column_count(stmt);
-	insert_columns = g_malloc(n_cols * sizeof(gint));
-	insert_values = g_malloc0(n_cols * sizeof(GValue));
-	for (i = 0; i < n_cols; ++i) {
-		insert_columns[i] = i;
-		g_value_init(&insert_values[i],
-			gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, i));
+	priv->table_flags = flags;
+	for (i = 0; i < n_columns; ++i) {
+		priv->sql_types[i] = g_strdup(specs[i].sql_type != NULL ? specs[i].sql_type :
+			sql_type_from_gtype(specs[i].type, flags & GTK_SQL_STORE_TABLE_STRICT));
+		priv->column_flags[i] = specs[i].flags;
 	}
 
-	gtk_list_store_clear(priv->store);
-
-	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
-		for (i = 0; i < n_cols; ++i) {
-			if (sqlite3_column_type(stmt, i) != SQLITE_NULL) {
-				GValue value = G_VALUE_INIT;
-				read_sql_column(&value, stmt, i);
-				g_value_transform(&value, &insert_values[i]);
-				g_value_unset(&value);
-			} else {
-				g_value_reset(&insert_values[i]);
-			}
-		}
+	g_free(columns);
+	g_free(types);
+}
 
-		gtk_list_store_insert_with_valuesv(priv->store,
-			NULL,
-			-1,
-			insert_columns,
-			insert_values,
-			n_cols);
+GtkSqlStore *gtk_sql_store_new_full(sqlite3 *db,
+                                    const gchar *table,
+                                    GtkSqlStoreTableFlags flags,
+                                    gint n_columns,
+                                    const GtkSqlStoreColumn *columns)
+{
+	GtkSqlStore *sql_store;
+	GtkSqlStorePrivate *priv;
 
-	}
+	g_warn_if_fail(n_columns > 0);
 
-	if (ret != SQLITE_DONE)
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	sql_store = g_object_new(gtk_sql_store_get_type(), NULL);
+	priv = sql_store->priv;
 
-	sqlite3_finalize(stmt);
+	priv->db = db;
+	priv->should_close_db = FALSE;
+	priv->table = g_strdup(table);
+	gtk_sql_store_init_column_specs(sql_store, flags, n_columns, columns);
+	priv->needs_load = TRUE;
 
-	for (i = 0; i < n_cols; ++i)
-		g_value_unset(&insert_values[i]);
+	gtk_sql_store_ensure_table_exists(sql_store, -1);
 
-	g_free(insert_columns);
-	g_free(insert_values);
+	return sql_store;
 }
 
-void gtk_sql_store_set_value(GtkSqlStore *sql_store,
-                             GtkTreeIter *iter,
-                             gint column,
-                             GValue value)
+GtkSqlStore *gtk_sql_store_new_with_file_full(const gchar *filename,
+                                              const gchar *table,
+                                              GtkSqlStoreTableFlags flags,
+                                              gint n_columns,
+                                              const GtkSqlStoreColumn *columns)
 {
-	gtk_sql_store_set_valuesv(sql_store, iter, &column, &value, 1);
-}
+	sqlite3 *db;
+	GtkSqlStore *sql_store;
 
-void gtk_sql_store_set(GtkSqlStore *sql_store,
-                       GtkTreeIter *iter,
-                       ...)
-{
-	GArray *columns;
-	GArray *values;
-	gint n_values;
-	va_list ap;
+	if (sqlite3_open(filename, &db)) {
+		g_warning("Failed to open database file: %s", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return NULL;
+	}
 
-	columns = g_array_new(FALSE, FALSE, sizeof(gint));
-	values = g_array_new(FALSE, TRUE, sizeof(GValue));
+	sql_store = gtk_sql_store_new_full(db, table, flags, n_columns, columns);
+	sql_store->priv->should_close_db = TRUE;
 
-	va_start(ap, iter);
-	for (n_values = 0; ; ++n_values) {
-		gint col = va_arg(ap, gint);
-		GValue val;
-		GType type;
+	return sql_store;
+}
 
-		if (col < 0)
-			break;
+GtkSqlStore *gtk_sql_store_new_sharded(const gchar **filenames,
+                                       gint n_files,
+                                       const gchar *table,
+                                       gint n_columns,
+                                       ...)
+{
+	int i;
+	va_list ap;
+	const gchar **columns;
+	GType *types;
+	GtkSqlStore *sql_store;
 
-		type = gtk_sql_store_get_column_type((GtkTreeModel *)sql_store, col);
-		val = arg_to_value(&ap, type);
+	g_warn_if_fail(n_columns > 0);
 
-		g_array_append_val(columns, col);
-		g_array_append_val(values, val);
+	columns = g_malloc(n_columns * sizeof(const gchar *));
+	types = g_malloc(n_columns * sizeof(GType));
+	va_start(ap, n_columns);
+	for (i = 0; i < n_columns; ++i) {
+		columns[i] = va_arg(ap, const gchar *);
+		types[i] = va_arg(ap, GType);
 	}
 	va_end(ap);
 
-	gtk_sql_store_set_valuesv(sql_store,
-		iter,
-		&g_array_index(columns, gint, 0),
-		&g_array_index(values, GValue, 0),
-		n_values);
+	sql_store = gtk_sql_store_new_shardedv(filenames, n_files, table, n_columns, columns, types);
 
-	while (n_values--)
-		g_value_unset(&g_array_index(values, GValue, n_values));
+	g_free(columns);
+	g_free(types);
 
-	g_array_free(columns, TRUE);
-	g_array_free(values, TRUE);
+	return sql_store;
 }
 
-void gtk_sql_store_set_valuesv(GtkSqlStore *sql_store,
-                               GtkTreeIter *iter,
-                               gint *columns,
-                               GValue *values,
-                               gint n_values)
+GtkSqlStore *gtk_sql_store_new_shardedv(const gchar **filenames,
+                                        gint n_files,
+                                        const gchar *table,
+                                        gint n_columns,
+                                        const gchar **columns,
+                                        GType *types)
 {
-	GtkSqlStorePrivate *priv = sql_store->priv;
-	GString *sql;
-	sqlite3_stmt *stmt;
-	GValue rowid_val = G_VALUE_INIT;
+	sqlite3 *db;
+	GtkSqlStore *sql_store;
+	GtkSqlStorePrivate *priv;
 	int i;
-	int ret;
 
-	gtk_tree_model_get_value((GtkTreeModel *)priv->store, iter, 0, &rowid_val);
+	g_warn_if_fail(n_columns > 0);
 
-	sql = g_string_new("");
-	g_string_printf(sql, "UPDATE \"%s\" SET ", priv->table);
-	for (i = 0; i < n_values; ++i) {
-		if (i != 0)
-			g_string_append(sql, ", ");
-		g_string_append_printf(sql, "\"%s\" = ?", priv->columns[columns[i]]);
+	/* the shards are ATTACHed to an otherwise empty connection */
+	if (sqlite3_open(":memory:", &db)) {
+		g_warning("Failed to open database: %s", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return NULL;
 	}
-	g_string_append(sql, " WHERE _ROWID_ = ?;");
 
-	ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+	sql_store = g_object_new(gtk_sql_store_get_type(), NULL);
+	priv = sql_store->priv;
+
+	priv->db = db;
+	priv->should_close_db = TRUE;
+	priv->table = g_strdup(table);
+	gtk_sql_store_init_columns(sql_store, n_columns, columns, types);
+	priv->needs_load = TRUE;
+
+	priv->shards = g_array_new(FALSE, FALSE, sizeof(GtkSqlStoreShard));
+	gtk_sql_store_rebuild_cache(sql_store);
+
+	for (i = 0; i < n_files; ++i)
+		gtk_sql_store_attach_shard(sql_store, filenames[i]);
+
+	return sql_store;
+}
+
+GtkSqlStore *gtk_sql_store_new_sharded_full(const gchar **filenames,
+                                            gint n_files,
+                                            const gchar *table,
+                                            GtkSqlStoreTableFlags flags,
+                                            gint n_columns,
+                                            const GtkSqlStoreColumn *columns)
+{
+	sqlite3 *db;
+	GtkSqlStore *sql_store;
+	GtkSqlStorePrivate *priv;
+	int i;
+
+	g_warn_if_fail(n_columns > 0);
+
+	if (sqlite3_open(":memory:", &db)) {
+		g_warning("Failed to open database: %s", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return NULL;
+	}
+
+	sql_store = g_object_new(gtk_sql_store_get_type(), NULL);
+	priv = sql_store->priv;
+
+	priv->db = db;
+	priv->should_close_db = TRUE;
+	priv->table = g_strdup(table);
+	gtk_sql_store_init_column_specs(sql_store, flags, n_columns, columns);
+	priv->needs_load = TRUE;
+
+	priv->shards = g_array_new(FALSE, FALSE, sizeof(GtkSqlStoreShard));
+	gtk_sql_store_rebuild_cache(sql_store);
+
+	for (i = 0; i < n_files; ++i)
+		gtk_sql_store_attach_shard(sql_store, filenames[i]);
+
+	return sql_store;
+}
+
+gint gtk_sql_store_attach_shard(GtkSqlStore *sql_store,
+                                const gchar *filename)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkSqlStoreShard shard;
+	sqlite3_stmt *stmt;
+	gchar *sql;
+	gchar *schema;
+	int ret;
+
+	if (priv->shards == NULL) {
+		g_warning("GtkSqlStore is not sharded");
+		return -1;
+	}
+
+	shard.id = priv->next_shard;
+	schema = g_strdup_printf("shard%d", shard.id);
+
+	sql = g_strdup_printf("ATTACH DATABASE ? AS \"%s\";", schema);
+	ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
+	g_free(sql);
+	if (ret == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, filename, -1, SQLITE_STATIC);
+		ret = sqlite3_step(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_DONE) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+		g_free(schema);
+		return -1;
+	}
+
+	++priv->next_shard;
+	shard.filename = g_strdup(sqlite3_db_filename(priv->db, schema));
+	g_array_append_val(priv->shards, shard);
+	g_free(schema);
+
+	gtk_sql_store_ensure_table_exists(sql_store, shard.id);
+	priv->write_shard = shard.id;
+
+	if (!priv->needs_load)
+		gtk_sql_store_requery(sql_store);
+
+	return shard.id;
+}
+
+void gtk_sql_store_detach_shard(GtkSqlStore *sql_store,
+                                gint shard)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gboolean current;
+	gboolean valid;
+	gchar *sql;
+	guint i;
+
+	if (priv->shards == NULL) {
+		g_warning("GtkSqlStore is not sharded");
+		return;
+	}
+
+	for (i = 0; i < priv->shards->len; ++i)
+		if (g_array_index(priv->shards, GtkSqlStoreShard, i).id == shard)
+			break;
+	g_return_if_fail(i < priv->shards->len);
+
+	current = gtk_sql_store_is_current(sql_store);
+
+	sql = g_strdup_printf("DETACH DATABASE \"shard%d\";", shard);
+	if (!gtk_sql_store_exec(sql_store, sql)) {
+		g_free(sql);
+		return;
+	}
+	g_free(sql);
+
+	g_free(g_array_index(priv->shards, GtkSqlStoreShard, i).filename);
+	g_array_remove_index(priv->shards, i);
+	if (priv->write_shard == shard)
+		priv->write_shard = priv->shards->len > 0 ?
+			g_array_index(priv->shards, GtkSqlStoreShard, priv->shards->len - 1).id : -1;
+
+	/* only the detached rows leave the cache, the others stay loaded */
+	path = gtk_tree_path_new_first();
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		if (gtk_sql_store_get_shard(sql_store, &iter) == shard) {
+			valid = gtk_list_store_remove(priv->store, &iter);
+			gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
+		} else {
+			valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+			gtk_tree_path_next(path);
+		}
+	}
+	gtk_tree_path_free(path);
+
+	if (current) {
+		priv->data_version = gtk_sql_store_query_pragma(sql_store, "data_version");
+		priv->schema_version = gtk_sql_store_query_pragma(sql_store, "schema_version");
+	}
+}
+
+void gtk_sql_store_set_write_shard(GtkSqlStore *sql_store,
+                                   gint shard)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	guint i;
+
+	g_return_if_fail(priv->shards != NULL);
+
+	for (i = 0; i < priv->shards->len; ++i) {
+		if (g_array_index(priv->shards, GtkSqlStoreShard, i).id == shard) {
+			priv->write_shard = shard;
+			return;
+		}
+	}
+
+	g_warning("GtkSqlStore has no shard %d", shard);
+}
+
+void gtk_sql_store_set_shard_sort_column(GtkSqlStore *sql_store,
+                                         gint column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	g_return_if_fail(priv->shards != NULL);
+	g_return_if_fail(column >= -1 && column < priv->n_columns);
+
+	if (priv->shard_sort_column == column)
+		return;
+	/* SQLite would order the compressed bytes */
+	if (column >= 0 && priv->compressed_columns[column] >= 0) {
+		g_warning("cannot merge shards on a compressed column");
+		return;
+	}
+
+	priv->shard_sort_column = column;
+	if (!priv->needs_load)
+		gtk_sql_store_requery(sql_store);
+}
+
+gint gtk_sql_store_get_shard(GtkSqlStore *sql_store,
+                             GtkTreeIter *iter)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint shard = -1;
+
+	if (priv->shard_cache_column >= 0)
+		gtk_tree_model_get((GtkTreeModel *)priv->store, iter, priv->shard_cache_column, &shard, -1);
+
+	return shard;
+}
+
+static GType type_from_decltype(const gchar *decltype)
+{
+	gchar *upper;
+	GType type = G_TYPE_INVALID;
+
+	if (decltype == NULL)
+		return G_TYPE_INVALID;
+
+	/* the same substring rules SQLite uses to pick a column affinity */
+	upper = g_ascii_strup(decltype, -1);
+	if (strstr(upper, "INT"))
+		type = G_TYPE_INT64;
+	else if (strstr(upper, "CHAR") || strstr(upper, "CLOB") || strstr(upper, "TEXT"))
+		type = G_TYPE_STRING;
+	else if (strstr(upper, "BLOB"))
+		type = G_TYPE_BYTES;
+	else if (strstr(upper, "REAL") || strstr(upper, "FLOA") || strstr(upper, "DOUB"))
+		type = G_TYPE_DOUBLE;
+	g_free(upper);
+
+	return type;
+}
+
+static GType type_from_storage_class(int storage_class)
+{
+	switch (storage_class) {
+	case SQLITE_INTEGER:
+		return G_TYPE_INT64;
+	case SQLITE_FLOAT:
+		return G_TYPE_DOUBLE;
+	case SQLITE_BLOB:
+		return G_TYPE_BYTES;
+	default:
+		return G_TYPE_STRING;
+	}
+}
+
+GtkSqlStore *gtk_sql_store_new_for_query(sqlite3 *db,
+                                         const gchar *sql,
+                                         GValue *params,
+                                         gint n_params)
+{
+	GtkSqlStore *sql_store;
+	GtkSqlStorePrivate *priv;
+	sqlite3_stmt *stmt;
+	gchar **columns;
+	GType *types;
+	gint n_columns;
+	gboolean stepped = FALSE;
+	gboolean has_row = FALSE;
+	int i;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(db));
+		sqlite3_finalize(stmt);
+		return NULL;
+	}
+
+	/* the store re-runs the statement, it has to be a side-effect free SELECT */
+	n_columns = sqlite3_column_count(stmt);
+	if (n_columns == 0 || !sqlite3_stmt_readonly(stmt)) {
+		g_warning("GtkSqlStore query must be a read-only statement returning columns");
+		sqlite3_finalize(stmt);
+		return NULL;
+	}
+
+	for (i = 0; i < n_params; ++i)
+		bind_sql_param(stmt, i + 1, &params[i]);
+
+	/* expressions have no declared type, take those from the first row */
+	columns = g_malloc0((n_columns + 1) * sizeof(gchar *));
+	types = g_malloc(n_columns * sizeof(GType));
+	for (i = 0; i < n_columns; ++i) {
+		columns[i] = g_strdup(sqlite3_column_name(stmt, i));
+		types[i] = type_from_decltype(sqlite3_column_decltype(stmt, i));
+	}
+	for (i = 0; i < n_columns; ++i) {
+		if (types[i] != G_TYPE_INVALID)
+			continue;
+
+		if (!stepped) {
+			stepped = TRUE;
+			has_row = sqlite3_step(stmt) == SQLITE_ROW;
+		}
+		types[i] = has_row ?
+			type_from_storage_class(sqlite3_column_type(stmt, i)) :
+			G_TYPE_STRING;
+	}
+	sqlite3_reset(stmt);
+
+	sql_store = g_object_new(gtk_sql_store_get_type(), NULL);
+	priv = sql_store->priv;
+
+	priv->db = db;
+	priv->should_close_db = FALSE;
+	priv->query_stmt = stmt;
+	gtk_sql_store_init_columns(sql_store, n_columns, (const gchar **)columns, types);
+
+	g_strfreev(columns);
+	g_free(types);
+
+	priv->needs_load = TRUE;
+
+	return sql_store;
+}
+
+void gtk_sql_store_set_query_params(GtkSqlStore *sql_store,
+                                    GValue *params,
+                                    gint n_params)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	int i;
+
+	g_return_if_fail(priv->query_stmt != NULL);
+
+	/* the prepared statement is kept, only the bindings change */
+	sqlite3_reset(priv->query_stmt);
+	sqlite3_clear_bindings(priv->query_stmt);
+	for (i = 0; i < n_params; ++i)
+		bind_sql_param(priv->query_stmt, i + 1, &params[i]);
+
+	gtk_sql_store_requery(sql_store);
+}
+
+static void gtk_sql_store_init_columns(GtkSqlStore *sql_store,
+                                       gint n_columns,
+                                       const gchar **columns,
+                                       GType *types)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GType *sub_types;
+	int i;
+
+	sub_types = g_malloc((1 + n_columns) * sizeof(GType));
+	sub_types[0] = G_TYPE_INT64;
+	memcpy(sub_types + 1, types, n_columns * sizeof(GType));
+
+	priv->store = gtk_list_store_newv(1 + n_columns, sub_types);
+	priv->n_columns = n_columns;
+	priv->columns = g_malloc(n_columns * sizeof(gchar *));
+	priv->fetched_columns = g_malloc(n_columns * sizeof(gint));
+	priv->fetch_stmts = g_malloc0(n_columns * sizeof(sqlite3_stmt *));
+	priv->compressed_columns = g_malloc(n_columns * sizeof(gint));
+	priv->sql_types = g_malloc0(n_columns * sizeof(gchar *));
+	priv->column_flags = g_malloc0(n_columns * sizeof(GtkSqlStoreColumnFlags));
+	for (i = 0; i < n_columns; ++i) {
+		priv->columns[i] = g_strdup(columns[i]);
+		priv->fetched_columns[i] = -1;
+		priv->compressed_columns[i] = -1;
+	}
+	priv->order_cache_column = -1;
+	priv->key_column = -1;
+	priv->write_shard = -1;
+	priv->shard_cache_column = -1;
+	priv->shard_sort_column = -1;
+
+	g_free(sub_types);
+}
+
+static void gtk_sql_store_ensure_loaded(GtkSqlStore *sql_store)
+{
+	if (G_UNLIKELY(sql_store->priv->needs_load))
+		gtk_sql_store_requery(sql_store);
+}
+
+static gboolean gtk_sql_store_check_writable(GtkSqlStore *sql_store)
+{
+	if (sql_store->priv->query_stmt != NULL) {
+		g_warning("GtkSqlStore backed by a query is read-only");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void gtk_sql_store_ensure_table_exists(GtkSqlStore *sql_store,
+                                              gint shard)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GString *sql;
+	gchar *table = gtk_sql_store_table_name(sql_store, shard);
+	int i;
+
+	sql = g_string_new("CREATE TABLE IF NOT EXISTS ");
+	g_string_append_printf(sql, "%s (", table);
+	g_free(table);
+	for (i = 0; i < priv->n_columns; ++i) {
+		if (i != 0)
+			g_string_append_printf(sql, ", ");
+		g_string_append_printf(sql, "\"%s\"", priv->columns[i]);
+		if (priv->sql_types[i] != NULL && *priv->sql_types[i] != '\0')
+			g_string_append_printf(sql, " %s", priv->sql_types[i]);
+		if (priv->column_flags[i] & GTK_SQL_STORE_COLUMN_NOT_NULL)
+			g_string_append(sql, " NOT NULL");
+	}
+	g_string_append_printf(sql, ")");
+	if (priv->table_flags & GTK_SQL_STORE_TABLE_STRICT)
+		g_string_append(sql, " STRICT");
+	g_string_append(sql, ";");
+
+	if (sqlite3_exec(priv->db, sql->str, NULL, NULL, NULL) != SQLITE_OK) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	}
+
+	g_string_free(sql, TRUE);
+
+	/* UNIQUE is an index too, so tables created before the flag get it */
+	for (i = 0; i < priv->n_columns; ++i) {
+		if (priv->column_flags[i] & GTK_SQL_STORE_COLUMN_UNIQUE)
+			gtk_sql_store_ensure_index(sql_store, shard, priv->columns[i], TRUE);
+		else if (priv->column_flags[i] & GTK_SQL_STORE_COLUMN_INDEXED)
+			gtk_sql_store_ensure_index(sql_store, shard, priv->columns[i], FALSE);
+	}
+}
+
+static gchar *gtk_sql_store_table_name(GtkSqlStore *sql_store,
+                                       gint shard)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	if (shard < 0)
+		return g_strdup_printf("\"%s\"", priv->table);
+
+	return g_strdup_printf("\"shard%d\".\"%s\"", shard, priv->table);
+}
+
+static gint gtk_sql_store_n_tables(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	return priv->shards != NULL ? (gint)priv->shards->len : 1;
+}
+
+static gint gtk_sql_store_nth_table(GtkSqlStore *sql_store,
+                                    gint n)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	if (priv->shards == NULL)
+		return -1;
+
+	return g_array_index(priv->shards, GtkSqlStoreShard, n).id;
+}
+
+static gint64 gtk_sql_store_query_pragma(GtkSqlStore *sql_store,
+                                         const gchar *pragma)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint64 sum = 0;
+	guint i;
+
+	if (priv->shards == NULL)
+		return query_pragma_int64(priv->db, pragma);
+
+	/* the counters are per schema, any change in a shard changes the sum */
+	for (i = 0; i < priv->shards->len; ++i) {
+		gchar *name = g_strdup_printf("shard%d.%s",
+			g_array_index(priv->shards, GtkSqlStoreShard, i).id, pragma);
+
+		sum += query_pragma_int64(priv->db, name);
+		g_free(name);
+	}
+
+	return sum;
+}
+
+static gint gtk_sql_store_append_selection(GtkSqlStore *sql_store,
+                                          GString *sql,
+                                          gint *insert_columns)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint n_cols = 0;
+	int i;
+
+	g_string_append(sql, "_ROWID_");
+	insert_columns[n_cols++] = 0;
+	for (i = 0; i < priv->n_columns; ++i) {
+		if (priv->fetched_columns[i] >= 0)
+			continue;
+		if (priv->compressed_columns[i] >= 0) {
+			/* decompressed on first access */
+			g_string_append_printf(sql, ", CAST(\"%s\" AS BLOB)", priv->columns[i]);
+			insert_columns[n_cols++] = priv->compressed_columns[i];
+			continue;
+		}
+		g_string_append_printf(sql, ", \"%s\"", priv->columns[i]);
+		insert_columns[n_cols++] = i + 1;
+	}
+	if (priv->order_column != NULL) {
+		g_string_append_printf(sql, ", \"%s\"", priv->order_column);
+		insert_columns[n_cols++] = priv->order_cache_column;
+	}
+
+	return n_cols;
+}
+
+static void gtk_sql_store_rebuild_cache(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkListStore *old_store = priv->store;
+	gint n_store_columns = 1 + priv->n_columns;
+	GType *types;
+	guint i;
+
+	/* hidden cache columns follow the model columns: a "fetched" flag
+	 * per deferred column, the raw value per compressed column, a
+	 * rendered string per display column, then the order key and shard */
+	types = g_malloc((3 + 3 * priv->n_columns + priv->displays->len) * sizeof(GType));
+	for (i = 0; i < 1 + priv->n_columns; ++i)
+		types[i] = gtk_tree_model_get_column_type((GtkTreeModel *)old_store, i);
+	for (i = 0; i < priv->n_columns; ++i) {
+		if (priv->fetched_columns[i] >= 0) {
+			priv->fetched_columns[i] = n_store_columns;
+			types[n_store_columns++] = G_TYPE_BOOLEAN;
+		}
+	}
+	for (i = 0; i < priv->n_columns; ++i) {
+		if (priv->compressed_columns[i] >= 0) {
+			priv->compressed_columns[i] = n_store_columns;
+			types[n_store_columns++] = G_TYPE_BYTES;
+		}
+	}
+	for (i = 0; i < priv->displays->len; ++i) {
+		g_array_index(priv->displays, GtkSqlStoreDisplay, i).cache_column = n_store_columns;
+		types[n_store_columns++] = G_TYPE_POINTER;
+	}
+	priv->order_cache_column = -1;
+	if (priv->order_column != NULL) {
+		priv->order_cache_column = n_store_columns;
+		types[n_store_columns++] = G_TYPE_DOUBLE;
+	}
+	priv->shard_cache_column = -1;
+	if (priv->shards != NULL) {
+		priv->shard_cache_column = n_store_columns;
+		types[n_store_columns++] = G_TYPE_INT;
+	}
+
+	gtk_sql_store_clear_cache(sql_store);
+	priv->store = gtk_list_store_newv(n_store_columns, types);
+	g_object_unref(old_store);
+	g_free(types);
+
+	if (!priv->needs_load)
+		gtk_sql_store_requery(sql_store);
+}
+
+void gtk_sql_store_set_column_deferred(GtkSqlStore *sql_store,
+                                       gint column,
+                                       gboolean deferred)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	g_return_if_fail(column >= 0 && column < priv->n_columns);
+
+	if (priv->query_stmt != NULL) {
+		g_warning("GtkSqlStore backed by a query cannot defer columns");
+		return;
+	}
+	if (priv->shards != NULL) {
+		g_warning("GtkSqlStore over shards cannot defer columns");
+		return;
+	}
+
+	if ((priv->fetched_columns[column] >= 0) == !!deferred)
+		return;
+
+	priv->fetched_columns[column] = deferred ? 0 : -1;
+	gtk_sql_store_rebuild_cache(sql_store);
+}
+
+void gtk_sql_store_set_column_compressed(GtkSqlStore *sql_store,
+                                         gint column,
+                                         gboolean compressed)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GType type;
+
+	g_return_if_fail(column >= 0 && column < priv->n_columns);
+
+	if (priv->query_stmt != NULL) {
+		g_warning("GtkSqlStore backed by a query cannot compress columns");
+		return;
+	}
+
+	/* existing blobs may start with a marker byte, text never does */
+	type = gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, column + 1);
+	if (type != G_TYPE_STRING) {
+		g_warning("cannot compress column of type %s", g_type_name(type));
+		return;
+	}
+
+	if (compressed && column == priv->shard_sort_column) {
+		g_warning("cannot compress the shard sort column");
+		return;
+	}
+
+	/* compressed values are BLOBs, a STRICT TEXT column rejects them */
+	if (compressed && (priv->table_flags & GTK_SQL_STORE_TABLE_STRICT) &&
+	    g_ascii_strcasecmp(priv->sql_types[column], "BLOB") != 0 &&
+	    g_ascii_strcasecmp(priv->sql_types[column], "ANY") != 0) {
+		g_warning("cannot compress STRICT column of type %s", priv->sql_types[column]);
+		return;
+	}
+
+	if ((priv->compressed_columns[column] >= 0) == !!compressed)
+		return;
+
+	priv->compressed_columns[column] = compressed ? 0 : -1;
+	gtk_sql_store_rebuild_cache(sql_store);
+}
+
+static void gtk_sql_store_decompress(GtkSqlStore *sql_store,
+                                     GtkTreeIter *iter,
+                                     gint column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint cache_columns[2];
+	GValue cache_values[2] = { G_VALUE_INIT, G_VALUE_INIT };
+	GBytes *raw;
+
+	gtk_tree_model_get((GtkTreeModel *)priv->store, iter,
+		priv->compressed_columns[column], &raw,
+		-1);
+	if (raw == NULL)
+		return;
+
+	cache_columns[0] = column + 1;
+	cache_columns[1] = priv->compressed_columns[column];
+	g_value_init(&cache_values[0],
+		gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, column + 1));
+	g_value_init(&cache_values[1], G_TYPE_BYTES);
+
+	{
+		gsize size;
+		gconstpointer data = g_bytes_get_data(raw, &size);
+
+		read_compressed_value(&cache_values[0], data, size);
+	}
+	gtk_list_store_set_valuesv(priv->store, iter, cache_columns, cache_values, 2);
+
+	g_value_unset(&cache_values[0]);
+	g_value_unset(&cache_values[1]);
+	g_bytes_unref(raw);
+}
+
+gint gtk_sql_store_add_display_column(GtkSqlStore *sql_store,
+                                      gint column,
+                                      const gchar *format)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkSqlStoreDisplay display = { 0, };
+
+	g_return_val_if_fail(column >= 0 && column < priv->n_columns, -1);
+
+	display.column = column;
+	display.format = g_strdup(format);
+	g_array_append_val(priv->displays, display);
+	gtk_sql_store_rebuild_cache(sql_store);
+
+	return priv->n_columns + priv->displays->len - 1;
+}
+
+gint gtk_sql_store_add_display_column_full(GtkSqlStore *sql_store,
+                                           gint column,
+                                           GtkSqlStoreDisplayFunc func,
+                                           gpointer user_data,
+                                           GDestroyNotify destroy)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkSqlStoreDisplay display = { 0, };
+
+	g_return_val_if_fail(column >= 0 && column < priv->n_columns, -1);
+	g_return_val_if_fail(func != NULL, -1);
+
+	display.column = column;
+	display.func = func;
+	display.user_data = user_data;
+	display.destroy = destroy;
+	g_array_append_val(priv->displays, display);
+	gtk_sql_store_rebuild_cache(sql_store);
+
+	return priv->n_columns + priv->displays->len - 1;
+}
+
+static gchar *gtk_sql_store_render_display(GtkSqlStore *sql_store,
+                                           GtkSqlStoreDisplay *display,
+                                           const GValue *value)
+{
+	if (display->func != NULL)
+		return display->func(sql_store, value, display->user_data);
+
+	if (display->format != NULL) {
+		switch (G_TYPE_FUNDAMENTAL(G_VALUE_TYPE(value))) {
+		case G_TYPE_BOOLEAN:
+			return g_strdup_printf(display->format, g_value_get_boolean(value));
+		case G_TYPE_INT:
+			return g_strdup_printf(display->format, g_value_get_int(value));
+		case G_TYPE_UINT:
+			return g_strdup_printf(display->format, g_value_get_uint(value));
+		case G_TYPE_INT64:
+			return g_strdup_printf(display->format, g_value_get_int64(value));
+		case G_TYPE_UINT64:
+			return g_strdup_printf(display->format, g_value_get_uint64(value));
+		case G_TYPE_DOUBLE:
+			return g_strdup_printf(display->format, g_value_get_double(value));
+		case G_TYPE_STRING:
+			return g_strdup_printf(display->format, g_value_get_string(value));
+		default:
+			break;
+		}
+	}
+
+	{
+		GValue str = G_VALUE_INIT;
+		gchar *result;
+
+		g_value_init(&str, G_TYPE_STRING);
+		if (g_value_transform(value, &str))
+			result = g_value_dup_string(&str);
+		else
+			result = g_strdup_value_contents(value);
+		g_value_unset(&str);
+
+		return result;
+	}
+}
+
+static void gtk_sql_store_get_display_value(GtkSqlStore *sql_store,
+                                            GtkTreeIter *iter,
+                                            gint index,
+                                            GValue *value)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkSqlStoreDisplay *display = &g_array_index(priv->displays, GtkSqlStoreDisplay, index);
+	GValue source = G_VALUE_INIT;
+	const gchar *text;
+	gchar *rendered;
+
+	/* redraws get the cached string itself, without a copy */
+	g_value_init(value, G_TYPE_STRING);
+	gtk_tree_model_get((GtkTreeModel *)priv->store, iter, display->cache_column, &text, -1);
+	if (text != NULL) {
+		g_value_set_static_string(value, text);
+		return;
+	}
+
+	gtk_sql_store_get_value((GtkTreeModel *)sql_store, iter, display->column, &source);
+	rendered = gtk_sql_store_render_display(sql_store, display, &source);
+	g_value_unset(&source);
+
+	text = g_string_chunk_insert_const(priv->display_strings, rendered != NULL ? rendered : "");
+	++priv->n_display_strings;
+	g_free(rendered);
+	gtk_list_store_set(priv->store, iter, display->cache_column, text, -1);
+	g_value_set_static_string(value, text);
+}
+
+static void gtk_sql_store_fetch_deferred(GtkSqlStore *sql_store,
+                                         GtkTreeIter *iter,
+                                         gint column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	sqlite3_stmt *stmt;
+	gint cache_columns[2];
+	GValue cache_values[2] = { G_VALUE_INIT, G_VALUE_INIT };
+	gboolean fetched;
+	gint64 rowid;
+	int ret;
+
+	gtk_tree_model_get((GtkTreeModel *)priv->store, iter,
+		0, &rowid,
+		priv->fetched_columns[column], &fetched,
+		-1);
+	if (fetched)
+		return;
+
+	if (priv->fetch_stmts[column] == NULL) {
+		gchar *sql = g_strdup_printf(priv->compressed_columns[column] >= 0 ?
+				"SELECT CAST(\"%s\" AS BLOB) FROM \"%s\" WHERE _ROWID_ = ?;" :
+				"SELECT \"%s\" FROM \"%s\" WHERE _ROWID_ = ?;",
+			priv->columns[column], priv->table);
+		ret = sqlite3_prepare_v2(priv->db, sql, -1, &priv->fetch_stmts[column], NULL);
+		g_free(sql);
+		if (ret != SQLITE_OK) {
+			g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+			return;
+		}
+	}
+
+	stmt = priv->fetch_stmts[column];
+	sqlite3_bind_int64(stmt, 1, rowid);
+
+	cache_columns[0] = column + 1;
+	cache_columns[1] = priv->fetched_columns[column];
+	g_value_init(&cache_values[0],
+		gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, column + 1));
+	g_value_init(&cache_values[1], G_TYPE_BOOLEAN);
+	g_value_set_boolean(&cache_values[1], TRUE);
+
+	/* a vanished row is cached as NULL rather than retried on every
+	 * redraw; an error such as SQLITE_BUSY is retried on the next access */
+	ret = sqlite3_step(stmt);
+	if (ret == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL &&
+	    priv->compressed_columns[column] >= 0) {
+		read_compressed_value(&cache_values[0],
+			sqlite3_column_blob(stmt, 0),
+			sqlite3_column_bytes(stmt, 0));
+	} else if (ret == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+		GValue value = G_VALUE_INIT;
+		read_sql_column(&value, stmt, 0);
+		g_value_transform(&value, &cache_values[0]);
+		g_value_unset(&value);
+	} else if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	}
+	sqlite3_reset(stmt);
+
+	if (ret == SQLITE_ROW || ret == SQLITE_DONE)
+		gtk_list_store_set_valuesv(priv->store, iter, cache_columns, cache_values, 2);
+
+	g_value_unset(&cache_values[0]);
+	g_value_unset(&cache_values[1]);
+}
+
+static void gtk_sql_store_values_changed(GtkSqlStore *sql_store,
+                                         GtkTreeIter *iter,
+                                         gint *columns,
+                                         gint n_values)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	guint d;
+	int i;
+
+	for (i = 0; i < n_values; ++i) {
+		if (priv->fetched_columns[columns[i]] >= 0)
+			gtk_list_store_set(priv->store, iter,
+				priv->fetched_columns[columns[i]], TRUE,
+				-1);
+		if (priv->compressed_columns[columns[i]] >= 0)
+			gtk_list_store_set(priv->store, iter,
+				priv->compressed_columns[columns[i]], NULL,
+				-1);
+
+		for (d = 0; d < priv->displays->len; ++d) {
+			GtkSqlStoreDisplay *display = &g_array_index(priv->displays, GtkSqlStoreDisplay, d);
+
+			if (display->column == columns[i])
+				gtk_list_store_set(priv->store, iter,
+					display->cache_column, NULL,
+					-1);
+		}
+	}
+}
+
+static void gtk_sql_store_clear_cache(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gint n_rows;
+
+	/* from the back, the remaining rows keep their paths */
+	n_rows = gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
+	while (n_rows-- > 0) {
+		gtk_tree_model_iter_nth_child((GtkTreeModel *)priv->store, &iter, NULL, n_rows);
+		gtk_list_store_remove(priv->store, &iter);
+		path = gtk_tree_path_new_from_indices(n_rows, -1);
+		gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
+		gtk_tree_path_free(path);
+	}
+
+	/* no cached row points at a rendered string any more */
+	g_string_chunk_clear(priv->display_strings);
+	priv->n_display_strings = 0;
+}
+
+static void gtk_sql_store_flush_display_strings(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	gboolean valid;
+	guint d;
+
+	/* strings of removed rows stay in the chunk until it is cleared, the
+	 * remaining rows render again on their next access */
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		for (d = 0; d < priv->displays->len; ++d)
+			gtk_list_store_set(priv->store, &iter,
+				g_array_index(priv->displays, GtkSqlStoreDisplay, d).cache_column, NULL,
+				-1);
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+	}
+	g_string_chunk_clear(priv->display_strings);
+	priv->n_display_strings = 0;
+}
+
+static void gtk_sql_store_announce_rows(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gboolean valid;
+
+	path = gtk_tree_path_new_first();
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		gtk_tree_model_row_inserted((GtkTreeModel *)sql_store, path, &iter);
+		gtk_tree_path_next(path);
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+	}
+	gtk_tree_path_free(path);
+}
+
+void gtk_sql_store_requery(GtkSqlStore *sql_store)
+{
+	/* the lazy first load runs inside model calls of a view that has
+	 * not seen any row yet, it must not hear about them again */
+	gboolean announce = !sql_store->priv->needs_load;
+
+	gtk_sql_store_clear_cache(sql_store);
+	gtk_sql_store_load(sql_store);
+	if (announce)
+		gtk_sql_store_announce_rows(sql_store);
+}
+
+/* fills the empty cache */
+static void gtk_sql_store_load(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	sqlite3_stmt *stmt;
+	int n_cols;
+	int offset;
+	gint *insert_columns;
+	GValue *insert_values;
+	gint64 n_rows = 0;
+	int i;
+	int ret;
+
+	insert_columns = g_malloc((2 + priv->n_columns) * sizeof(gint));
+
+	priv->loaded = FALSE;
+	priv->needs_load = FALSE;
+	priv->follow_valid = FALSE;
+	priv->data_version = gtk_sql_store_query_pragma(sql_store, "data_version");
+	priv->schema_version = gtk_sql_store_query_pragma(sql_store, "schema_version");
+	priv->total_changes = sqlite3_total_changes(priv->db);
+
+	if (priv->shards != NULL) {
+		priv->loaded = gtk_sql_store_requery_shards(sql_store);
+		g_free(insert_columns);
+		return;
+	}
+
+	if (priv->load_threads > 1 && priv->query_stmt == NULL &&
+	    priv->order_column == NULL && priv->follow_max_rows <= 0 &&
+	    gtk_sql_store_requery_parallel(sql_store)) {
+		priv->loaded = TRUE;
+		g_free(insert_columns);
+		return;
+	}
+
+	if (priv->query_stmt != NULL) {
+		/* query stores have no ROWID, column 0 holds the row number */
+		stmt = priv->query_stmt;
+		sqlite3_reset(stmt);
+		offset = 1;
+		n_cols = 1 + priv->n_columns;
+		for (i = 0; i < n_cols; ++i)
+			insert_columns[i] = i;
+	} else {
+		GString *sql = g_string_new("SELECT ");
+
+		n_cols = gtk_sql_store_append_selection(sql_store, sql, insert_columns);
+		g_string_append_printf(sql, " FROM \"%s\"", priv->table);
+		if (priv->order_column != NULL) {
+			g_string_append_printf(sql, " ORDER BY \"%s\", _ROWID_", priv->order_column);
+		} else if (priv->follow_max_rows > 0) {
+			/* a capped follower only ever shows the newest rows */
+			g_string_prepend(sql, "SELECT * FROM (");
+			g_string_append_printf(sql, " ORDER BY _ROWID_ DESC LIMIT %d) ORDER BY 1",
+				priv->follow_max_rows);
+		}
+		g_string_append(sql, ";");
+
+		ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+		g_string_free(sql, TRUE);
+
+		if (ret != SQLITE_OK) {
+			g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+			sqlite3_finalize(stmt);
+			g_free(insert_columns);
+			return;
+		}
+		offset = 0;
+	}
+
+	insert_values = g_malloc0(n_cols * sizeof(GValue));
+	for (i = 0; i < n_cols; ++i)
+		g_value_init(&insert_values[i],
+			gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, insert_columns[i]));
+
+	gtk_list_store_clear(priv->store);
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (offset)
+			g_value_set_int64(&insert_values[0], n_rows++);
+
+		for (i = offset; i < n_cols; ++i) {
+			if (sqlite3_column_type(stmt, i - offset) != SQLITE_NULL) {
+				GValue value = G_VALUE_INIT;
+				read_sql_column(&value, stmt, i - offset);
+				g_value_transform(&value, &insert_values[i]);
+				g_value_unset(&value);
+			} else {
+				g_value_reset(&insert_values[i]);
+			}
+		}
+
+		gtk_list_store_insert_with_valuesv(priv->store,
+			NULL,
+			-1,
+			insert_columns,
+			insert_values,
+			n_cols);
+
+	}
+
+	if (ret != SQLITE_DONE)
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	else
+		priv->loaded = TRUE;
+
+	if (priv->query_stmt != NULL)
+		sqlite3_reset(stmt);
+	else
+		sqlite3_finalize(stmt);
+
+	for (i = 0; i < n_cols; ++i)
+		g_value_unset(&insert_values[i]);
+
+	g_free(insert_columns);
+	g_free(insert_values);
+}
+
+typedef struct
+{
+	const gchar *filename;
+	const gchar *sql;
+	gint64 first;
+	gint64 last;
+	gint n_cols;
+	GType *types;
+	GArray *values;
+	gboolean ok;
+} GtkSqlStoreChunk;
+
+static void gtk_sql_store_read_chunk(GtkSqlStoreChunk *chunk, sqlite3 *db)
+{
+	sqlite3_stmt *stmt = NULL;
+	int i;
+	int ret;
+
+	ret = sqlite3_prepare_v2(db, chunk->sql, -1, &stmt, NULL);
+
+	if (ret == SQLITE_OK) {
+		sqlite3_bind_int64(stmt, 1, chunk->first);
+		sqlite3_bind_int64(stmt, 2, chunk->last);
+
+		while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+			guint base = chunk->values->len;
+
+			g_array_set_size(chunk->values, base + chunk->n_cols);
+			for (i = 0; i < chunk->n_cols; ++i) {
+				GValue *cell = &g_array_index(chunk->values, GValue, base + i);
+
+				g_value_init(cell, chunk->types[i]);
+				if (sqlite3_column_type(stmt, i) != SQLITE_NULL) {
+					GValue value = G_VALUE_INIT;
+					read_sql_column(&value, stmt, i);
+					g_value_transform(&value, cell);
+					g_value_unset(&value);
+				}
+			}
+		}
+	}
+
+	chunk->ok = ret == SQLITE_DONE;
+
+	sqlite3_finalize(stmt);
+}
+
+static void gtk_sql_store_load_chunk(gpointer data, gpointer user_data)
+{
+	GtkSqlStoreChunk *chunk = data;
+	sqlite3 *db;
+
+	if (sqlite3_open_v2(chunk->filename, &db,
+			SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) == SQLITE_OK)
+		gtk_sql_store_read_chunk(chunk, db);
+	else
+		chunk->ok = FALSE;
+
+	sqlite3_close(db);
+}
+
+static gboolean gtk_sql_store_requery_parallel(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	const gchar *filename = sqlite3_db_filename(priv->db, "main");
+	GtkSqlStoreChunk *chunks;
+	GThreadPool *pool;
+	sqlite3_stmt *stmt;
+	GString *sql;
+	gint64 min_rowid;
+	gint64 max_rowid;
+	guint64 span;
+	gint n_chunks = priv->load_threads;
+	gint n_cols;
+	gint *insert_columns;
+	GType *types;
+	gboolean ok = TRUE;
+	int i;
+
+	/* other connections cannot see an open transaction or a memory db,
+	 * and a single-threaded SQLite build cannot be used from workers */
+	if (filename == NULL || *filename == '\0' || !sqlite3_get_autocommit(priv->db) ||
+	    !sqlite3_threadsafe())
+		return FALSE;
+
+	sql = g_string_new("");
+	g_string_printf(sql, "SELECT min(_ROWID_), max(_ROWID_) FROM \"%s\";", priv->table);
+	if (sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL) != SQLITE_OK ||
+	    sqlite3_step(stmt) != SQLITE_ROW ||
+	    sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
+		ok = FALSE;
+	} else {
+		min_rowid = sqlite3_column_int64(stmt, 0);
+		max_rowid = sqlite3_column_int64(stmt, 1);
+	}
+	sqlite3_finalize(stmt);
+
+	if (ok)
+		pool = g_thread_pool_new(gtk_sql_store_load_chunk, NULL, n_chunks, TRUE, NULL);
+	if (!ok || pool == NULL) {
+		g_string_free(sql, TRUE);
+		return FALSE;
+	}
+
+	insert_columns = g_malloc((2 + priv->n_columns) * sizeof(gint));
+	g_string_assign(sql, "SELECT ");
+	n_cols = gtk_sql_store_append_selection(sql_store, sql, insert_columns);
+	g_string_append_printf(sql,
+		" FROM \"%s\" WHERE _ROWID_ BETWEEN ? AND ? ORDER BY _ROWID_;",
+		priv->table);
+
+	types = g_malloc(n_cols * sizeof(GType));
+	for (i = 0; i < n_cols; ++i)
+		types[i] = gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, insert_columns[i]);
+
+	/* equal ROWID ranges, one read-only connection per range */
+	span = (guint64)max_rowid - (guint64)min_rowid;
+	chunks = g_new0(GtkSqlStoreChunk, n_chunks);
+	for (i = 0; i < n_chunks; ++i) {
+		chunks[i].filename = filename;
+		chunks[i].sql = sql->str;
+		chunks[i].first = min_rowid + (gint64)(span / n_chunks * i);
+		chunks[i].last = i == n_chunks - 1 ? max_rowid :
+			min_rowid + (gint64)(span / n_chunks * (i + 1)) - 1;
+		chunks[i].n_cols = n_cols;
+		chunks[i].types = types;
+		chunks[i].values = g_array_new(FALSE, TRUE, sizeof(GValue));
+		g_array_set_clear_func(chunks[i].values, (GDestroyNotify)g_value_unset);
+		g_thread_pool_push(pool, &chunks[i], NULL);
+	}
+	g_thread_pool_free(pool, FALSE, TRUE);
+
+	/* the chunks are only one consistent table if nobody committed while
+	 * they were read */
+	for (i = 0; i < n_chunks; ++i)
+		ok = ok && chunks[i].ok;
+	ok = ok && priv->total_changes == sqlite3_total_changes(priv->db) &&
+		priv->data_version == gtk_sql_store_query_pragma(sql_store, "data_version");
+
+	if (ok) {
+		gtk_list_store_clear(priv->store);
+		for (i = 0; i < n_chunks; ++i) {
+			guint row;
+
+			for (row = 0; row < chunks[i].values->len; row += n_cols)
+				gtk_list_store_insert_with_valuesv(priv->store,
+					NULL,
+					-1,
+					insert_columns,
+					&g_array_index(chunks[i].values, GValue, row),
+					n_cols);
+		}
+	}
+
+	for (i = 0; i < n_chunks; ++i)
+		g_array_free(chunks[i].values, TRUE);
+	g_free(chunks);
+	g_free(types);
+	g_free(insert_columns);
+	g_string_free(sql, TRUE);
+
+	return ok;
+}
+
+static gint compare_values(const GValue *a, const GValue *b)
+{
+	switch (G_TYPE_FUNDAMENTAL(G_VALUE_TYPE(a))) {
+	case G_TYPE_BOOLEAN:
+		return !!g_value_get_boolean(a) - !!g_value_get_boolean(b);
+	case G_TYPE_INT: {
+		gint value_a = g_value_get_int(a);
+		gint value_b = g_value_get_int(b);
+		return value_a < value_b ? -1 : value_a > value_b;
+	}
+	case G_TYPE_UINT: {
+		guint value_a = g_value_get_uint(a);
+		guint value_b = g_value_get_uint(b);
+		return value_a < value_b ? -1 : value_a > value_b;
+	}
+	case G_TYPE_INT64: {
+		gint64 value_a = g_value_get_int64(a);
+		gint64 value_b = g_value_get_int64(b);
+		return value_a < value_b ? -1 : value_a > value_b;
+	}
+	case G_TYPE_UINT64: {
+		guint64 value_a = g_value_get_uint64(a);
+		guint64 value_b = g_value_get_uint64(b);
+		return value_a < value_b ? -1 : value_a > value_b;
+	}
+	case G_TYPE_DOUBLE: {
+		gdouble value_a = g_value_get_double(a);
+		gdouble value_b = g_value_get_double(b);
+		return value_a < value_b ? -1 : value_a > value_b;
+	}
+	case G_TYPE_STRING:
+		/* byte order, like SQLite's BINARY collation */
+		return g_strcmp0(g_value_get_string(a), g_value_get_string(b));
+	default:
+		return 0;
+	}
+}
+
+/* a sort key is followed by its IS NULL flag, NULLs sort first */
+static gint compare_sort_keys(const GValue *a, const GValue *b)
+{
+	gint64 null_a = g_value_get_int64(&a[1]);
+	gint64 null_b = g_value_get_int64(&b[1]);
+
+	if (null_a || null_b)
+		return !null_a - !null_b;
+	return compare_values(a, b);
+}
+
+static gboolean gtk_sql_store_requery_shards(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkSqlStoreChunk *chunks;
+	GString *selection;
+	gint n_shards = priv->shards->len;
+	gint n_cols;
+	gint stride;
+	gint sort_pos = -1;
+	gint *insert_columns;
+	GType *types;
+	guint *heads;
+	GThreadPool *pool;
+	gboolean parallel;
+	gboolean ok;
+	int i;
+
+	insert_columns = g_malloc((3 + priv->n_columns) * sizeof(gint));
+	selection = g_string_new("SELECT ");
+	n_cols = gtk_sql_store_append_selection(sql_store, selection, insert_columns);
+	insert_columns[n_cols++] = priv->shard_cache_column;
+
+	/* the merge key is selected on its own after the cached columns, a
+	 * deferred column is not among those */
+	stride = n_cols;
+	if (priv->shard_sort_column >= 0) {
+		sort_pos = stride;
+		stride += 2;
+	}
+
+	types = g_malloc(stride * sizeof(GType));
+	for (i = 0; i < n_cols; ++i)
+		types[i] = gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, insert_columns[i]);
+	if (sort_pos >= 0) {
+		types[sort_pos] = gtk_tree_model_get_column_type((GtkTreeModel *)priv->store,
+			priv->shard_sort_column + 1);
+		types[sort_pos + 1] = G_TYPE_INT64;
+	}
+
+	/* a read-only connection per shard file, unless that would miss our
+	 * own open transaction or a shard only lives in memory */
+	parallel = priv->load_threads > 1 && n_shards > 1 && sqlite3_get_autocommit(priv->db) &&
+		sqlite3_threadsafe();
+	for (i = 0; i < n_shards; ++i) {
+		const gchar *filename = g_array_index(priv->shards, GtkSqlStoreShard, i).filename;
+		parallel = parallel && filename != NULL && *filename != '\0';
+	}
+
+	for (;;) {
+		pool = NULL;
+		if (parallel) {
+			pool = g_thread_pool_new(gtk_sql_store_load_chunk, NULL,
+				MIN(priv->load_threads, n_shards), TRUE, NULL);
+			parallel = pool != NULL;
+		}
+
+		chunks = g_new0(GtkSqlStoreChunk, n_shards);
+		for (i = 0; i < n_shards; ++i) {
+			GtkSqlStoreShard *shard = &g_array_index(priv->shards, GtkSqlStoreShard, i);
+			gchar *table = gtk_sql_store_table_name(sql_store, parallel ? -1 : shard->id);
+			GString *sql = g_string_new(selection->str);
+
+			g_string_append_printf(sql, ", %d", shard->id);
+			if (sort_pos >= 0)
+				g_string_append_printf(sql, ", \"%s\", \"%s\" IS NULL",
+					priv->columns[priv->shard_sort_column],
+					priv->columns[priv->shard_sort_column]);
+			g_string_append_printf(sql, " FROM %s WHERE _ROWID_ BETWEEN ? AND ?", table);
+			if (sort_pos >= 0)
+				g_string_append_printf(sql, " ORDER BY \"%s\", _ROWID_",
+					priv->columns[priv->shard_sort_column]);
+			g_string_append(sql, ";");
+			g_free(table);
+
+			chunks[i].filename = shard->filename;
+			chunks[i].sql = g_string_free(sql, FALSE);
+			chunks[i].first = G_MININT64;
+			chunks[i].last = G_MAXINT64;
+			chunks[i].n_cols = stride;
+			chunks[i].types = types;
+			chunks[i].values = g_array_new(FALSE, TRUE, sizeof(GValue));
+			g_array_set_clear_func(chunks[i].values, (GDestroyNotify)g_value_unset);
+		}
+
+		if (parallel) {
+			for (i = 0; i < n_shards; ++i)
+				g_thread_pool_push(pool, &chunks[i], NULL);
+			g_thread_pool_free(pool, FALSE, TRUE);
+		} else {
+			for (i = 0; i < n_shards; ++i)
+				gtk_sql_store_read_chunk(&chunks[i], priv->db);
+		}
+
+		ok = TRUE;
+		for (i = 0; i < n_shards; ++i)
+			ok = ok && chunks[i].ok;
+		ok = ok && priv->total_changes == sqlite3_total_changes(priv->db) &&
+			priv->data_version == gtk_sql_store_query_pragma(sql_store, "data_version");
+
+		if (ok || !parallel)
+			break;
+
+		/* somebody committed while the threads read, so the shards may
+		 * not match; read them again one after the other */
+		for (i = 0; i < n_shards; ++i) {
+			g_free((gchar *)chunks[i].sql);
+			g_array_free(chunks[i].values, TRUE);
+		}
+		g_free(chunks);
+		parallel = FALSE;
+		priv->data_version = gtk_sql_store_query_pragma(sql_store, "data_version");
+		priv->schema_version = gtk_sql_store_query_pragma(sql_store, "schema_version");
+		priv->total_changes = sqlite3_total_changes(priv->db);
+	}
+
+	if (!ok)
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+
+	gtk_list_store_clear(priv->store);
+
+	/* each shard is already sorted, merging takes the smallest head */
+	heads = g_new0(guint, n_shards);
+	while (ok) {
+		gint next = -1;
+
+		for (i = 0; i < n_shards; ++i) {
+			if (heads[i] >= chunks[i].values->len)
+				continue;
+			if (next < 0 || (sort_pos >= 0 &&
+			    compare_sort_keys(&g_array_index(chunks[i].values, GValue, heads[i] + sort_pos),
+			                      &g_array_index(chunks[next].values, GValue, heads[next] + sort_pos)) < 0))
+				next = i;
+		}
+		if (next < 0)
+			break;
+
+		gtk_list_store_insert_with_valuesv(priv->store,
+			NULL,
+			-1,
+			insert_columns,
+			&g_array_index(chunks[next].values, GValue, heads[next]),
+			n_cols);
+		heads[next] += stride;
+	}
+	g_free(heads);
+
+	for (i = 0; i < n_shards; ++i) {
+		g_free((gchar *)chunks[i].sql);
+		g_array_free(chunks[i].values, TRUE);
+	}
+	g_free(chunks);
+	g_free(types);
+	g_free(insert_columns);
+	g_string_free(selection, TRUE);
+
+	return ok;
+}
+
+void gtk_sql_store_set_load_threads(GtkSqlStore *sql_store,
+                                    gint n_threads)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	priv->load_threads = n_threads > 0 ? n_threads : (gint)g_get_num_processors();
+}
+
+static void gtk_sql_store_trim_follow(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gint n_rows;
+
+	/* keep only the newest rows */
+	if (priv->follow_max_rows > 0) {
+		n_rows = gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
+		path = gtk_tree_path_new_first();
+		while (n_rows-- > priv->follow_max_rows &&
+		       gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter)) {
+			gtk_list_store_remove(priv->store, &iter);
+			gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
+		}
+		gtk_tree_path_free(path);
+	}
+
+	/* a follower never requeries, so it sheds the strings of the rows
+	 * it dropped here, outside of any model call */
+	n_rows = gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
+	if (priv->n_display_strings > 2 * n_rows * priv->displays->len + 1024)
+		gtk_sql_store_flush_display_strings(sql_store);
+}
+
+static gboolean gtk_sql_store_follow_tick(gpointer data)
+{
+	GtkSqlStore *sql_store = data;
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GString *sql;
+	sqlite3_stmt *stmt;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gint *insert_columns;
+	GValue *insert_values;
+	gint n_cols;
+	gboolean valid;
+	int i;
+	int ret;
+
+	/* nothing to follow before the first load, and nothing to trust
+	 * while our connection is inside a transaction that may roll back */
+	if (!priv->loaded || !sqlite3_get_autocommit(priv->db))
+		return G_SOURCE_CONTINUE;
+
+	/* writes through our own connection that the store did not account
+	 * for need not be appends, only a full reload is safe; total_changes
+	 * counts every table, so a write to any other table on a shared
+	 * connection reloads the follower as well */
+	if (priv->schema_version != gtk_sql_store_query_pragma(sql_store, "schema_version") ||
+	    priv->total_changes != sqlite3_total_changes(priv->db)) {
+		gtk_sql_store_requery(sql_store);
+		return G_SOURCE_CONTINUE;
+	}
+	if (priv->data_version == gtk_sql_store_query_pragma(sql_store, "data_version"))
+		return G_SOURCE_CONTINUE;
+
+	if (!priv->follow_valid) {
+		priv->follow_rowid = G_MININT64;
+		valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+		while (valid) {
+			gint64 rowid;
+
+			gtk_tree_model_get((GtkTreeModel *)priv->store, &iter, 0, &rowid, -1);
+			priv->follow_rowid = MAX(priv->follow_rowid, rowid);
+			valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+		}
+		priv->follow_valid = TRUE;
+	}
+
+	/* stamp first, commits during the fetch are picked up next time */
+	priv->data_version = gtk_sql_store_query_pragma(sql_store, "data_version");
+
+	insert_columns = g_malloc((2 + priv->n_columns) * sizeof(gint));
+	sql = g_string_new("SELECT ");
+	n_cols = gtk_sql_store_append_selection(sql_store, sql, insert_columns);
+	g_string_append_printf(sql, " FROM \"%s\" WHERE _ROWID_ > ? ORDER BY _ROWID_;", priv->table);
+
+	ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+	g_string_free(sql, TRUE);
+
+	insert_values = g_malloc0(n_cols * sizeof(GValue));
+	for (i = 0; i < n_cols; ++i)
+		g_value_init(&insert_values[i],
+			gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, insert_columns[i]));
+
+	if (ret == SQLITE_OK) {
+		sqlite3_bind_int64(stmt, 1, priv->follow_rowid);
+
+		while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+			for (i = 0; i < n_cols; ++i) {
+				if (sqlite3_column_type(stmt, i) != SQLITE_NULL) {
+					GValue value = G_VALUE_INIT;
+					read_sql_column(&value, stmt, i);
+					g_value_transform(&value, &insert_values[i]);
+					g_value_unset(&value);
+				} else {
+					g_value_reset(&insert_values[i]);
+				}
+			}
+
+			gtk_list_store_insert_with_valuesv(priv->store,
+				&iter,
+				-1,
+				insert_columns,
+				insert_values,
+				n_cols);
+			priv->follow_rowid = sqlite3_column_int64(stmt, 0);
+
+			path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, &iter);
+			gtk_tree_model_row_inserted((GtkTreeModel *)sql_store, path, &iter);
+			gtk_tree_path_free(path);
+		}
+	}
+
+	if (ret != SQLITE_DONE)
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+
+	sqlite3_finalize(stmt);
+	for (i = 0; i < n_cols; ++i)
+		g_value_unset(&insert_values[i]);
+	g_free(insert_values);
+	g_free(insert_columns);
+
+	gtk_sql_store_trim_follow(sql_store);
+
+	return G_SOURCE_CONTINUE;
+}
+
+void gtk_sql_store_set_follow(GtkSqlStore *sql_store,
+                              guint interval,
+                              gint max_rows)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	if (priv->query_stmt != NULL || priv->shards != NULL || priv->order_column != NULL) {
+		g_warning("GtkSqlStore can only follow an unordered table");
+		return;
+	}
+
+	if (priv->follow_source != 0) {
+		g_source_remove(priv->follow_source);
+		priv->follow_source = 0;
+	}
+
+	priv->follow_max_rows = interval > 0 ? max_rows : 0;
+	if (interval > 0)
+		priv->follow_source = g_timeout_add(interval, gtk_sql_store_follow_tick, sql_store);
+
+	/* a quiet table would never tick down to a new cap */
+	if (priv->loaded)
+		gtk_sql_store_trim_follow(sql_store);
+}
+
+gboolean gtk_sql_store_requery_if_changed(GtkSqlStore *sql_store)
+{
+	if (gtk_sql_store_is_current(sql_store))
+		return FALSE;
+
+	gtk_sql_store_requery(sql_store);
+	return TRUE;
+}
+
+static gboolean gtk_sql_store_is_current(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	/* total_changes covers writes through this connection, data_version
+	 * commits from other connections and schema_version DDL from either */
+	return priv->loaded &&
+		priv->total_changes == sqlite3_total_changes(priv->db) &&
+		priv->data_version == gtk_sql_store_query_pragma(sql_store, "data_version") &&
+		priv->schema_version == gtk_sql_store_query_pragma(sql_store, "schema_version");
+}
+
+static void gtk_sql_store_sync_changes(GtkSqlStore *sql_store,
+                                       gint changes_before,
+                                       gint n_changed)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	/* the cache was patched for exactly the rows we changed; anything else
+	 * (e.g. triggers touching more rows) leaves it stale, and so does an
+	 * open transaction the caller may still roll back */
+	if (sqlite3_get_autocommit(priv->db) &&
+	    priv->total_changes == changes_before &&
+	    sqlite3_total_changes(priv->db) - changes_before == n_changed)
+		priv->total_changes += n_changed;
+}
+
+static gboolean gtk_sql_store_exec(GtkSqlStore *sql_store,
+                                   const gchar *sql)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	if (sqlite3_exec(priv->db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void gtk_sql_store_set_value(GtkSqlStore *sql_store,
+                             GtkTreeIter *iter,
+                             gint column,
+                             GValue value)
+{
+	gtk_sql_store_set_valuesv(sql_store, iter, &column, &value, 1);
+}
+
+void gtk_sql_store_set(GtkSqlStore *sql_store,
+                       GtkTreeIter *iter,
+                       ...)
+{
+	GArray *columns;
+	GArray *values;
+	gint n_values;
+	va_list ap;
+
+	columns = g_array_new(FALSE, FALSE, sizeof(gint));
+	values = g_array_new(FALSE, TRUE, sizeof(GValue));
+
+	va_start(ap, iter);
+	for (n_values = 0; ; ++n_values) {
+		gint col = va_arg(ap, gint);
+		GValue val;
+		GType type;
+
+		if (col < 0)
+			break;
+
+		type = gtk_sql_store_get_column_type((GtkTreeModel *)sql_store, col);
+		val = arg_to_value(&ap, type);
+
+		g_array_append_val(columns, col);
+		g_array_append_val(values, val);
+	}
+	va_end(ap);
+
+	gtk_sql_store_set_valuesv(sql_store,
+		iter,
+		&g_array_index(columns, gint, 0),
+		&g_array_index(values, GValue, 0),
+		n_values);
+
+	while (n_values--)
+		g_value_unset(&g_array_index(values, GValue, n_values));
+
+	g_array_free(columns, TRUE);
+	g_array_free(values, TRUE);
+}
+
+void gtk_sql_store_set_valuesv(GtkSqlStore *sql_store,
+                               GtkTreeIter *iter,
+                               gint *columns,
+                               GValue *values,
+                               gint n_values)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GString *sql;
+	sqlite3_stmt *stmt;
+	GValue rowid_val = G_VALUE_INIT;
+	gchar *table;
+	gint changes = sqlite3_total_changes(priv->db);
+	int i;
+	int ret;
+
+	/* display columns are model columns too, but cannot be written */
+	for (i = 0; i < n_values; ++i)
+		g_return_if_fail(columns[i] >= 0 && columns[i] < priv->n_columns);
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+
+	gtk_tree_model_get_value((GtkTreeModel *)priv->store, iter, 0, &rowid_val);
+	table = gtk_sql_store_table_name(sql_store, gtk_sql_store_get_shard(sql_store, iter));
+
+	sql = g_string_new("");
+	g_string_printf(sql, "UPDATE %s SET ", table);
+	g_free(table);
+	for (i = 0; i < n_values; ++i) {
+		if (i != 0)
+			g_string_append(sql, ", ");
+		g_string_append_printf(sql, "\"%s\" = ?", priv->columns[columns[i]]);
+	}
+	g_string_append(sql, " WHERE _ROWID_ = ?;");
+
+	ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+	if (ret == SQLITE_OK) {
+		for (i = 0; i < n_values; ++i)
+			bind_column_param(sql_store, stmt, i + 1, columns[i], &values[i]);
+		sqlite3_bind_int64(stmt, i + 1, g_value_get_int64(&rowid_val));
+	}
+
+	if (ret == SQLITE_OK)
+		ret = sqlite3_step(stmt);
+
+	if (ret == SQLITE_DONE) {
+		gtk_sql_store_set_cached_values(sql_store, iter, columns, values, n_values);
+		gtk_sql_store_sync_changes(sql_store, changes, 1);
+	} else {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	}
+
+	g_string_free(sql, TRUE);
+	sqlite3_finalize(stmt);
+
+	{
+		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, iter);
+		gtk_tree_model_row_changed((GtkTreeModel *)sql_store, path, iter);
+		gtk_tree_path_free(path);
+	}
+}
+
+void gtk_sql_store_update_where(GtkSqlStore *sql_store,
+                                const gchar *predicate,
+                                ...)
+{
+	GArray *columns;
+	GArray *values;
+	GArray *params;
+	gint n_values;
+	gint n_params;
+	va_list ap;
+
+	columns = g_array_new(FALSE, FALSE, sizeof(gint));
+	values = g_array_new(FALSE, TRUE, sizeof(GValue));
+	params = g_array_new(FALSE, TRUE, sizeof(GValue));
+
+	va_start(ap, predicate);
+	for (n_values = 0; ; ++n_values) {
+		gint col = va_arg(ap, gint);
+		GValue val;
+		GType type;
+
+		if (col < 0)
+			break;
+
+		type = gtk_sql_store_get_column_type((GtkTreeModel *)sql_store, col);
+		val = arg_to_value(&ap, type);
+
+		g_array_append_val(columns, col);
+		g_array_append_val(values, val);
+	}
+	for (n_params = 0; ; ++n_params) {
+		GType type = va_arg(ap, GType);
+		GValue val;
+
+		if (type == G_TYPE_INVALID)
+			break;
+
+		val = arg_to_value(&ap, type);
+		g_array_append_val(params, val);
+	}
+	va_end(ap);
+
+	gtk_sql_store_update_wherev(sql_store,
+		&g_array_index(columns, gint, 0),
+		&g_array_index(values, GValue, 0),
+		n_values,
+		predicate,
+		&g_array_index(params, GValue, 0),
+		n_params);
+
+	while (n_values--)
+		g_value_unset(&g_array_index(values, GValue, n_values));
+	while (n_params--)
+		g_value_unset(&g_array_index(params, GValue, n_params));
+
+	g_array_free(columns, TRUE);
+	g_array_free(values, TRUE);
+	g_array_free(params, TRUE);
+}
+
+void gtk_sql_store_update_wherev(GtkSqlStore *sql_store,
+                                 gint *columns,
+                                 GValue *values,
+                                 gint n_values,
+                                 const gchar *predicate,
+                                 GValue *params,
+                                 gint n_params)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GString *sql;
+	sqlite3_stmt *stmt;
+	GArray **rowids;
+	gint n_tables;
+	gint changes;
+	gint n_changed = 0;
+	gchar *table;
+	int t;
+	int i;
+	int ret = SQLITE_DONE;
+
+	for (i = 0; i < n_values; ++i)
+		g_return_if_fail(columns[i] >= 0 && columns[i] < priv->n_columns);
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+	gtk_sql_store_ensure_loaded(sql_store);
+
+	if (n_values <= 0)
+		return;
+
+	if (!gtk_sql_store_exec(sql_store, "SAVEPOINT gtk_sql_store;"))
+		return;
+
+	n_tables = gtk_sql_store_n_tables(sql_store);
+	rowids = g_new0(GArray *, n_tables);
+	changes = sqlite3_total_changes(priv->db);
+
+	/* one statement per shard, each patching only its own rows */
+	for (t = 0; t < n_tables && ret == SQLITE_DONE; ++t) {
+		table = gtk_sql_store_table_name(sql_store, gtk_sql_store_nth_table(sql_store, t));
+		rowids[t] = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+		sql = g_string_new("");
+		g_string_printf(sql, "UPDATE %s SET ", table);
+		for (i = 0; i < n_values; ++i) {
+			if (i != 0)
+				g_string_append(sql, ", ");
+			g_string_append_printf(sql, "\"%s\" = ?", priv->columns[columns[i]]);
+		}
+		g_string_append_printf(sql, " WHERE (%s) RETURNING _ROWID_;", predicate);
+
+		ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+		g_string_free(sql, TRUE);
+		g_free(table);
+
+		if (ret == SQLITE_OK) {
+			for (i = 0; i < n_values; ++i)
+				bind_column_param(sql_store, stmt, i + 1, columns[i], &values[i]);
+			for (i = 0; i < n_params; ++i)
+				bind_sql_param(stmt, n_values + i + 1, &params[i]);
+
+			while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+				gint64 rowid = sqlite3_column_int64(stmt, 0);
+				g_array_append_val(rowids[t], rowid);
+			}
+		}
+
+		if (ret == SQLITE_DONE)
+			n_changed += rowids[t]->len;
+		else
+			g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+
+		sqlite3_finalize(stmt);
+	}
+
+	/* the cache only follows once every shard is committed */
+	if (ret == SQLITE_DONE && gtk_sql_store_exec(sql_store, "RELEASE gtk_sql_store;")) {
+		gtk_sql_store_sync_changes(sql_store, changes, n_changed);
+		for (t = 0; t < n_tables; ++t)
+			gtk_sql_store_update_cached_rows(sql_store, gtk_sql_store_nth_table(sql_store, t),
+				rowids[t], columns, values, n_values);
+	} else {
+		gtk_sql_store_exec(sql_store, "ROLLBACK TO gtk_sql_store; RELEASE gtk_sql_store;");
+	}
+
+	for (t = 0; t < n_tables; ++t)
+		if (rowids[t] != NULL)
+			g_array_free(rowids[t], TRUE);
+	g_free(rowids);
+}
+
+static void gtk_sql_store_set_cached_values(GtkSqlStore *sql_store,
+                                            GtkTreeIter *iter,
+                                            gint *columns,
+                                            GValue *values,
+                                            gint n_values)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint *sub_columns = g_newa(gint, n_values);
+	int i;
+
+	for (i = 0; i < n_values; ++i)
+		sub_columns[i] = columns[i] + 1;
+
+	gtk_list_store_set_valuesv(priv->store, iter, sub_columns, values, n_values);
+	gtk_sql_store_values_changed(sql_store, iter, columns, n_values);
+}
+
+static void gtk_sql_store_update_cached_rows(GtkSqlStore *sql_store,
+                                             gint shard,
+                                             GArray *rowids,
+                                             gint *columns,
+                                             GValue *values,
+                                             gint n_values)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gboolean valid;
+
+	if (rowids->len == 0)
+		return;
+
+	g_array_sort(rowids, compare_rowids);
+
+	path = gtk_tree_path_new_first();
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		gint64 rowid;
+
+		gtk_tree_model_get((GtkTreeModel *)priv->store, &iter, 0, &rowid, -1);
+		if (bsearch(&rowid, rowids->data, rowids->len, sizeof(gint64), compare_rowids) &&
+		    gtk_sql_store_get_shard(sql_store, &iter) == shard) {
+			gtk_sql_store_set_cached_values(sql_store, &iter, columns, values, n_values);
+			gtk_tree_model_row_changed((GtkTreeModel *)sql_store, path, &iter);
+		}
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+		gtk_tree_path_next(path);
+	}
+	gtk_tree_path_free(path);
+}
+
+void gtk_sql_store_remove(GtkSqlStore *sql_store,
+                          GtkTreeIter *iter)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GValue row_id = G_VALUE_INIT;
+	gchar *table;
+	gchar *sql;
+	sqlite3_stmt *stmt;
+	gint changes = sqlite3_total_changes(priv->db);
+	int ret;
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+
+	gtk_tree_model_get_value((GtkTreeModel *)priv->store, iter, 0, &row_id);
+	table = gtk_sql_store_table_name(sql_store, gtk_sql_store_get_shard(sql_store, iter));
+
+	sql = g_strdup_printf("DELETE FROM %s WHERE _ROWID_ = ?;", table);
+	g_free(table);
+	ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
+	g_free(sql);
+
+	if (ret == SQLITE_OK) {
+		sqlite3_bind_int64(stmt, 1, g_value_get_int64(&row_id));
+		ret = sqlite3_step(stmt);
+	}
+
+	if (ret == SQLITE_DONE) {
+		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, iter);
+
+		gtk_list_store_remove(priv->store, iter);
+		gtk_sql_store_sync_changes(sql_store, changes, 1);
+		gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
+		gtk_tree_path_free(path);
+	} else {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	}
+
+	sqlite3_finalize(stmt);
+	g_value_unset(&row_id);
+}
+
+static gint compare_rows_by_shard(gconstpointer a, gconstpointer b)
+{
+	const GtkSqlStoreRow *row_a = a;
+	const GtkSqlStoreRow *row_b = b;
+
+	return row_a->shard - row_b->shard;
+}
+
+static gint compare_rows_descending(gconstpointer a, gconstpointer b)
+{
+	const GtkSqlStoreRow *row_a = a;
+	const GtkSqlStoreRow *row_b = b;
+
+	return row_b->index - row_a->index;
+}
+
+void gtk_sql_store_remove_rows(GtkSqlStore *sql_store,
+                               GtkTreeIter *iters,
+                               gint n_iters)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkSqlStoreRow *rows;
+	gint max_params;
+	gint n_chunk;
+	gint changes = sqlite3_total_changes(priv->db);
+	gint n_deleted = 0;
+	gint i;
+	int ret = SQLITE_OK;
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+
+	if (n_iters <= 0)
+		return;
+
+	rows = g_new(GtkSqlStoreRow, n_iters);
+	for (i = 0; i < n_iters; ++i) {
+		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, &iters[i]);
+
+		rows[i].iter = iters[i];
+		rows[i].index = gtk_tree_path_get_indices(path)[0];
+		gtk_tree_model_get((GtkTreeModel *)priv->store, &iters[i], 0, &rows[i].rowid, -1);
+		rows[i].shard = gtk_sql_store_get_shard(sql_store, &iters[i]);
+		gtk_tree_path_free(path);
+	}
+	if (priv->shards != NULL)
+		qsort(rows, n_iters, sizeof(GtkSqlStoreRow), compare_rows_by_shard);
+
+	/* one DELETE per chunk of bound ROWIDs, all inside one transaction */
+	max_params = sqlite3_limit(priv->db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+	if (!gtk_sql_store_exec(sql_store, "SAVEPOINT gtk_sql_store;")) {
+		g_free(rows);
+		return;
+	}
+
+	for (i = 0; i < n_iters && ret == SQLITE_OK; i += n_chunk) {
+		GString *sql;
+		sqlite3_stmt *stmt;
+		gchar *table;
+		gint j;
+
+		/* a chunk never spans two shards */
+		n_chunk = 1;
+		while (i + n_chunk < n_iters && n_chunk < max_params &&
+		       rows[i + n_chunk].shard == rows[i].shard)
+			++n_chunk;
+		table = gtk_sql_store_table_name(sql_store, rows[i].shard);
+
+		sql = g_string_new("");
+		g_string_printf(sql, "DELETE FROM %s WHERE _ROWID_ IN (", table);
+		g_free(table);
+		for (j = 0; j < n_chunk; ++j)
+			g_string_append(sql, j != 0 ? ", ?" : "?");
+		g_string_append(sql, ");");
+
+		ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+		if (ret == SQLITE_OK) {
+			for (j = 0; j < n_chunk; ++j)
+				sqlite3_bind_int64(stmt, j + 1, rows[i + j].rowid);
+			ret = sqlite3_step(stmt);
+		}
+
+		if (ret == SQLITE_DONE) {
+			n_deleted += sqlite3_changes(priv->db);
+			ret = SQLITE_OK;
+		}
+
+		g_string_free(sql, TRUE);
+		sqlite3_finalize(stmt);
+	}
+
+	if (ret != SQLITE_OK)
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	if (ret != SQLITE_OK || !gtk_sql_store_exec(sql_store, "RELEASE gtk_sql_store;")) {
+		gtk_sql_store_exec(sql_store, "ROLLBACK TO gtk_sql_store; RELEASE gtk_sql_store;");
+		g_free(rows);
+		return;
+	}
+
+	gtk_sql_store_sync_changes(sql_store, changes, n_deleted);
+
+	/* removing back to front keeps the remaining indices valid */
+	qsort(rows, n_iters, sizeof(GtkSqlStoreRow), compare_rows_descending);
+	for (i = 0; i < n_iters; ++i) {
+		GtkTreePath *path;
+
+		if (i != 0 && rows[i].index == rows[i - 1].index)
+			continue;
+
+		path = gtk_tree_path_new_from_indices(rows[i].index, -1);
+		gtk_list_store_remove(priv->store, &rows[i].iter);
+		gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
+		gtk_tree_path_free(path);
+	}
+
+	g_free(rows);
+}
+
+void gtk_sql_store_remove_where(GtkSqlStore *sql_store,
+                                const gchar *predicate,
+                                ...)
+{
+	GArray *params;
+	gint n_params;
+	va_list ap;
+
+	params = g_array_new(FALSE, TRUE, sizeof(GValue));
+
+	va_start(ap, predicate);
+	for (n_params = 0; ; ++n_params) {
+		GType type = va_arg(ap, GType);
+		GValue val;
+
+		if (type == G_TYPE_INVALID)
+			break;
+
+		val = arg_to_value(&ap, type);
+		g_array_append_val(params, val);
+	}
+	va_end(ap);
+
+	gtk_sql_store_remove_wherev(sql_store,
+		predicate,
+		&g_array_index(params, GValue, 0),
+		n_params);
+
+	while (n_params--)
+		g_value_unset(&g_array_index(params, GValue, n_params));
+
+	g_array_free(params, TRUE);
+}
+
+void gtk_sql_store_remove_wherev(GtkSqlStore *sql_store,
+                                 const gchar *predicate,
+                                 GValue *params,
+                                 gint n_params)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gchar *sql;
+	sqlite3_stmt *stmt;
+	GArray **rowids;
+	gint n_tables;
+	gint changes;
+	gint n_deleted = 0;
+	gchar *table;
+	int t;
+	int i;
+	int ret = SQLITE_DONE;
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+	gtk_sql_store_ensure_loaded(sql_store);
+
+	if (!gtk_sql_store_exec(sql_store, "SAVEPOINT gtk_sql_store;"))
+		return;
+
+	n_tables = gtk_sql_store_n_tables(sql_store);
+	rowids = g_new0(GArray *, n_tables);
+	changes = sqlite3_total_changes(priv->db);
+
+	for (t = 0; t < n_tables && ret == SQLITE_DONE; ++t) {
+		table = gtk_sql_store_table_name(sql_store, gtk_sql_store_nth_table(sql_store, t));
+		rowids[t] = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+		sql = g_strdup_printf("DELETE FROM %s WHERE (%s) RETURNING _ROWID_;",
+			table, predicate);
+		ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
+		g_free(sql);
+		g_free(table);
+
+		if (ret == SQLITE_OK) {
+			for (i = 0; i < n_params; ++i)
+				bind_sql_param(stmt, i + 1, &params[i]);
+
+			/* the whole DELETE runs on the first step, RETURNING rows are buffered */
+			while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+				gint64 rowid = sqlite3_column_int64(stmt, 0);
+				g_array_append_val(rowids[t], rowid);
+			}
+		}
+
+		if (ret == SQLITE_DONE)
+			n_deleted += rowids[t]->len;
+		else
+			g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+
+		sqlite3_finalize(stmt);
+	}
+
+	if (ret == SQLITE_DONE && gtk_sql_store_exec(sql_store, "RELEASE gtk_sql_store;")) {
+		gtk_sql_store_sync_changes(sql_store, changes, n_deleted);
+		for (t = 0; t < n_tables; ++t)
+			gtk_sql_store_remove_cached_rows(sql_store, gtk_sql_store_nth_table(sql_store, t),
+				rowids[t]);
+	} else {
+		gtk_sql_store_exec(sql_store, "ROLLBACK TO gtk_sql_store; RELEASE gtk_sql_store;");
+	}
+
+	for (t = 0; t < n_tables; ++t)
+		if (rowids[t] != NULL)
+			g_array_free(rowids[t], TRUE);
+	g_free(rowids);
+}
+
+static gint compare_rowids(gconstpointer a, gconstpointer b)
+{
+	gint64 rowid_a = *(const gint64 *)a;
+	gint64 rowid_b = *(const gint64 *)b;
+
+	return rowid_a < rowid_b ? -1 : rowid_a > rowid_b;
+}
+
+static void gtk_sql_store_remove_cached_rows(GtkSqlStore *sql_store,
+                                             gint shard,
+                                             GArray *rowids)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	GtkTreePath *path;
+	gboolean valid;
+
+	if (rowids->len == 0)
+		return;
+
+	g_array_sort(rowids, compare_rowids);
+
+	path = gtk_tree_path_new_first();
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		gint64 rowid;
+
+		gtk_tree_model_get((GtkTreeModel *)priv->store, &iter, 0, &rowid, -1);
+		if (bsearch(&rowid, rowids->data, rowids->len, sizeof(gint64), compare_rowids) &&
+		    gtk_sql_store_get_shard(sql_store, &iter) == shard) {
+			valid = gtk_list_store_remove(priv->store, &iter);
+			gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
+		} else {
+			valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+			gtk_tree_path_next(path);
+		}
+	}
+	gtk_tree_path_free(path);
+}
+
+void gtk_sql_store_insert(GtkSqlStore *sql_store,
+                          GtkTreeIter *iter)
+{
+	gtk_sql_store_insert_with_valuesv(sql_store, iter, NULL, NULL, 0);
+}
+
+#define ORDER_KEY_GAP 1024.0
+
+static void gtk_sql_store_ensure_index(GtkSqlStore *sql_store,
+                                       gint shard,
+                                       const gchar *column,
+                                       gboolean unique)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gchar *schema;
+	gchar *sql;
+
+	/* an attached schema qualifies the index name, not the table; unique
+	 * indexes get their own name so an existing plain one does not
+	 * satisfy IF NOT EXISTS */
+	schema = shard < 0 ? g_strdup("") : g_strdup_printf("\"shard%d\".", shard);
+	sql = g_strdup_printf("CREATE %sINDEX IF NOT EXISTS %s\"%s_%s_%s\" ON \"%s\"(\"%s\");",
+		unique ? "UNIQUE " : "", schema, priv->table, column, unique ? "key" : "idx",
+		priv->table, column);
+	gtk_sql_store_exec(sql_store, sql);
+	g_free(sql);
+	g_free(schema);
+}
+
+static gboolean gtk_sql_store_has_column(GtkSqlStore *sql_store,
+                                         const gchar *column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	sqlite3_stmt *stmt;
+	gboolean found = FALSE;
+
+	if (sqlite3_prepare_v2(priv->db,
+			"SELECT 1 FROM pragma_table_info(?) WHERE name = ?;",
+			-1, &stmt, NULL) == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, priv->table, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+		found = sqlite3_step(stmt) == SQLITE_ROW;
+	}
+	sqlite3_finalize(stmt);
+
+	return found;
+}
+
+void gtk_sql_store_set_order_column(GtkSqlStore *sql_store,
+                                    const gchar *column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gchar *sql;
+
+	if (priv->query_stmt != NULL) {
+		g_warning("GtkSqlStore backed by a query cannot be reordered");
+		return;
+	}
+	if (priv->shards != NULL) {
+		g_warning("GtkSqlStore over shards cannot be reordered");
+		return;
+	}
+	if (priv->follow_source != 0) {
+		g_warning("GtkSqlStore following a table cannot be reordered");
+		return;
+	}
+
+	if (g_strcmp0(priv->order_column, column) == 0)
+		return;
+
+	g_free(priv->order_column);
+	priv->order_column = g_strdup(column);
+
+	if (column != NULL) {
+		if (!gtk_sql_store_has_column(sql_store, column)) {
+			sql = g_strdup_printf("ALTER TABLE \"%s\" ADD COLUMN \"%s\" REAL;",
+				priv->table, column);
+			gtk_sql_store_exec(sql_store, sql);
+			g_free(sql);
+		}
+		gtk_sql_store_ensure_index(sql_store, -1, column, FALSE);
+
+		/* rows written without the store keep their ROWID order; the gap
+		 * is an integer literal, %f would follow the locale's decimal mark */
+		sql = g_strdup_printf("UPDATE \"%s\" SET \"%s\" = _ROWID_ * %d WHERE \"%s\" IS NULL;",
+			priv->table, column, (gint)ORDER_KEY_GAP, column);
+		gtk_sql_store_exec(sql_store, sql);
+		g_free(sql);
+	}
+
+	gtk_sql_store_rebuild_cache(sql_store);
+}
+
+static gdouble gtk_sql_store_get_order_key(GtkSqlStore *sql_store,
+                                           GtkTreeIter *iter)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gdouble key;
+
+	gtk_tree_model_get((GtkTreeModel *)priv->store, iter, priv->order_cache_column, &key, -1);
+
+	return key;
+}
+
+static gboolean gtk_sql_store_renumber_order(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter iter;
+	sqlite3_stmt *stmt;
+	gchar *sql;
+	gboolean valid;
+	gdouble key = 0;
+	gint changes = sqlite3_total_changes(priv->db);
+	gint n_rows = 0;
+	int ret;
+
+	sql = g_strdup_printf("UPDATE \"%s\" SET \"%s\" = ? WHERE _ROWID_ = ?;",
+		priv->table, priv->order_column);
+	ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
+	g_free(sql);
+
+	if (ret != SQLITE_OK || !gtk_sql_store_exec(sql_store, "SAVEPOINT gtk_sql_store;")) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+		sqlite3_finalize(stmt);
+		return FALSE;
+	}
+
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid && ret == SQLITE_OK) {
+		gint64 rowid;
+
+		key += ORDER_KEY_GAP;
+		gtk_tree_model_get((GtkTreeModel *)priv->store, &iter, 0, &rowid, -1);
+		sqlite3_bind_double(stmt, 1, key);
+		sqlite3_bind_int64(stmt, 2, rowid);
+		ret = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+		sqlite3_reset(stmt);
+		++n_rows;
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+	}
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_OK)
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	if (ret != SQLITE_OK || !gtk_sql_store_exec(sql_store, "RELEASE gtk_sql_store;")) {
+		gtk_sql_store_exec(sql_store, "ROLLBACK TO gtk_sql_store; RELEASE gtk_sql_store;");
+		return FALSE;
+	}
+	gtk_sql_store_sync_changes(sql_store, changes, n_rows);
+
+	key = 0;
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		key += ORDER_KEY_GAP;
+		gtk_list_store_set(priv->store, &iter, priv->order_cache_column, key, -1);
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+	}
+
+	return TRUE;
+}
+
+static void gtk_sql_store_move(GtkSqlStore *sql_store,
+                               GtkTreeIter *iter,
+                               gint dest_index)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeModel *store = (GtkTreeModel *)priv->store;
+	GtkTreeIter before;
+	GtkTreeIter after;
+	GtkTreePath *path;
+	gboolean has_before;
+	gboolean has_after;
+	gdouble key;
+	gint n_rows = gtk_tree_model_iter_n_children(store, NULL);
+	gint changes = sqlite3_total_changes(priv->db);
+	gint *new_order;
+	gint old_index;
+	gint new_index;
+	gint64 rowid;
+	gchar *sql;
+	sqlite3_stmt *stmt;
+	int i;
+	int ret;
+
+	if (priv->order_column == NULL) {
+		g_warning("GtkSqlStore has no order column");
+		return;
+	}
+
+	path = gtk_tree_model_get_path(store, iter);
+	old_index = gtk_tree_path_get_indices(path)[0];
+	gtk_tree_path_free(path);
+
+	/* dest_index is the insert position in the current order */
+	if (dest_index < 0 || dest_index > n_rows)
+		dest_index = n_rows;
+	if (dest_index == old_index || dest_index == old_index + 1)
+		return;
+	new_index = dest_index > old_index ? dest_index - 1 : dest_index;
+
+	for (;;) {
+		has_before = dest_index > 0 &&
+			gtk_tree_model_iter_nth_child(store, &before, NULL, dest_index - 1);
+		has_after = dest_index < n_rows &&
+			gtk_tree_model_iter_nth_child(store, &after, NULL, dest_index);
+
+		if (has_before && has_after)
+			key = (gtk_sql_store_get_order_key(sql_store, &before) +
+			       gtk_sql_store_get_order_key(sql_store, &after)) / 2;
+		else if (has_before)
+			key = gtk_sql_store_get_order_key(sql_store, &before) + ORDER_KEY_GAP;
+		else
+			key = gtk_sql_store_get_order_key(sql_store, &after) - ORDER_KEY_GAP;
+
+		/* only when the gap between two keys is exhausted */
+		if ((!has_before || key > gtk_sql_store_get_order_key(sql_store, &before)) &&
+		    (!has_after || key < gtk_sql_store_get_order_key(sql_store, &after)))
+			break;
+		if (!gtk_sql_store_renumber_order(sql_store))
+			return;
+	}
+
+	gtk_tree_model_get(store, iter, 0, &rowid, -1);
+
+	sql = g_strdup_printf("UPDATE \"%s\" SET \"%s\" = ? WHERE _ROWID_ = ?;",
+		priv->table, priv->order_column);
+	ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
+	g_free(sql);
+
+	if (ret == SQLITE_OK) {
+		sqlite3_bind_double(stmt, 1, key);
+		sqlite3_bind_int64(stmt, 2, rowid);
+		ret = sqlite3_step(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_DONE) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+		return;
+	}
+	gtk_sql_store_sync_changes(sql_store, changes, 1);
+
+	gtk_list_store_set(priv->store, iter, priv->order_cache_column, key, -1);
+	if (has_after)
+		gtk_list_store_move_before(priv->store, iter, &after);
+	else
+		gtk_list_store_move_before(priv->store, iter, NULL);
+
+	/* new_order[new position] = old position */
+	new_order = g_new(gint, n_rows);
+	for (i = 0; i < n_rows; ++i)
+		new_order[i] = i;
+	if (new_index > old_index) {
+		for (i = old_index; i < new_index; ++i)
+			new_order[i] = i + 1;
+	} else {
+		for (i = old_index; i > new_index; --i)
+			new_order[i] = i - 1;
+	}
+	new_order[new_index] = old_index;
+
+	path = gtk_tree_path_new();
+	gtk_tree_model_rows_reordered((GtkTreeModel *)sql_store, path, NULL, new_order);
+	gtk_tree_path_free(path);
+	g_free(new_order);
+}
+
+void gtk_sql_store_move_before(GtkSqlStore *sql_store,
+                               GtkTreeIter *iter,
+                               GtkTreeIter *position)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint dest_index = -1;
+
+	if (position != NULL) {
+		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, position);
+		dest_index = gtk_tree_path_get_indices(path)[0];
+		gtk_tree_path_free(path);
+	}
+
+	gtk_sql_store_move(sql_store, iter, dest_index);
+}
+
+void gtk_sql_store_move_after(GtkSqlStore *sql_store,
+                              GtkTreeIter *iter,
+                              GtkTreeIter *position)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint dest_index = 0;
+
+	if (position != NULL) {
+		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, position);
+		dest_index = gtk_tree_path_get_indices(path)[0] + 1;
+		gtk_tree_path_free(path);
+	}
+
+	gtk_sql_store_move(sql_store, iter, dest_index);
+}
+
+static gdouble gtk_sql_store_next_order_key(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeIter last;
+	gint n_rows;
+
+	/* new rows go last */
+	n_rows = gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
+	if (priv->order_column == NULL || n_rows == 0 ||
+	    !gtk_tree_model_iter_nth_child((GtkTreeModel *)priv->store, &last, NULL, n_rows - 1))
+		return ORDER_KEY_GAP;
+
+	return gtk_sql_store_get_order_key(sql_store, &last) + ORDER_KEY_GAP;
+}
+
+static void gtk_sql_store_append_cached_row(GtkSqlStore *sql_store,
+                                            GtkTreeIter *iter,
+                                            gint64 rowid,
+                                            gint *columns,
+                                            GValue *values,
+                                            gint n_values,
+                                            gdouble order_key)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint *sub_columns = g_newa(gint, n_values + 3);
+	GValue *sub_values = g_newa(GValue, n_values + 3);
+	GtkTreePath *path;
+	gint n_sub = 0;
+	int i;
+
+	memset(sub_values, 0, (n_values + 3) * sizeof(GValue));
+
+	sub_columns[n_sub] = 0;
+	g_value_init(&sub_values[n_sub], G_TYPE_INT64);
+	g_value_set_int64(&sub_values[n_sub++], rowid);
+
+	for (i = 0; i < n_values; ++i) {
+		sub_columns[n_sub] = columns[i] + 1;
+		sub_values[n_sub++] = values[i];
+	}
+
+	if (priv->order_column != NULL) {
+		sub_columns[n_sub] = priv->order_cache_column;
+		g_value_init(&sub_values[n_sub], G_TYPE_DOUBLE);
+		g_value_set_double(&sub_values[n_sub++], order_key);
+	}
+
+	if (priv->shard_cache_column >= 0) {
+		sub_columns[n_sub] = priv->shard_cache_column;
+		g_value_init(&sub_values[n_sub], G_TYPE_INT);
+		g_value_set_int(&sub_values[n_sub++], priv->write_shard);
+	}
+
+	gtk_list_store_insert_with_valuesv(priv->store, iter, -1, sub_columns, sub_values, n_sub);
+	gtk_sql_store_values_changed(sql_store, iter, columns, n_values);
+	if (priv->follow_valid)
+		priv->follow_rowid = MAX(priv->follow_rowid, rowid);
+
+	path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, iter);
+	gtk_tree_model_row_inserted((GtkTreeModel *)sql_store, path, iter);
+	gtk_tree_path_free(path);
+}
+
+void gtk_sql_store_insert_with_values(GtkSqlStore *sql_store,
+                                      GtkTreeIter *iter,
+                                      ...)
+{
+	GArray *columns;
+	GArray *values;
+	gint n_values;
+	va_list ap;
+
+	columns = g_array_new(FALSE, FALSE, sizeof(gint));
+	values = g_array_new(FALSE, TRUE, sizeof(GValue));
+
+	va_start(ap, iter);
+	for (n_values = 0; ; ++n_values) {
+		gint col = va_arg(ap, gint);
+		GValue val;
+		GType type;
+
+		if (col < 0)
+			break;
+
+		type = gtk_sql_store_get_column_type((GtkTreeModel *)sql_store, col);
+		val = arg_to_value(&ap, type);
+
+		g_array_append_val(columns, col);
+		g_array_append_val(values, val);
+	}
+	va_end(ap);
+
+	gtk_sql_store_insert_with_valuesv(sql_store,
+		iter,
+		&g_array_index(columns, gint, 0),
+		&g_array_index(values, GValue, 0),
+		n_values);
+
+	while (n_values--)
+		g_value_unset(&g_array_index(values, GValue, n_values));
+
+	g_array_free(columns, TRUE);
+	g_array_free(values, TRUE);
+}
+
+void gtk_sql_store_insert_with_valuesv(GtkSqlStore *sql_store,
+                                       GtkTreeIter *iter,
+                                       gint *columns,
+                                       GValue *values,
+                                       gint n_values)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GString *sql;
+	sqlite3_stmt *stmt;
+	GtkTreeIter new_iter;
+	gint changes = sqlite3_total_changes(priv->db);
+	gchar *table;
+	gdouble order_key;
+	int i;
+	int ret;
+
+	for (i = 0; i < n_values; ++i)
+		g_return_if_fail(columns[i] >= 0 && columns[i] < priv->n_columns);
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+	gtk_sql_store_ensure_loaded(sql_store);
+
+	if (iter == NULL)
+		iter = &new_iter;
+
+	if (priv->shards != NULL && priv->write_shard < 0) {
+		g_warning("GtkSqlStore has no shard to write to");
+		return;
+	}
+
+	order_key = gtk_sql_store_next_order_key(sql_store);
+	table = gtk_sql_store_table_name(sql_store, priv->write_shard);
+
+	sql = g_string_new("");
+	g_string_printf(sql, "INSERT INTO %s", table);
+	g_free(table);
+	if (n_values == 0 && priv->order_column == NULL) {
+		g_string_append(sql, " DEFAULT VALUES;");
+	} else {
+		g_string_append(sql, "(");
+		for (i = 0; i < n_values; ++i) {
+			if (i != 0)
+				g_string_append(sql, ", ");
+			g_string_append_printf(sql, "\"%s\"", priv->columns[columns[i]]);
+		}
+		if (priv->order_column != NULL)
+			g_string_append_printf(sql, "%s\"%s\"", n_values ? ", " : "", priv->order_column);
+		g_string_append(sql, ") VALUES (");
+		for (i = 0; i < n_values + (priv->order_column != NULL); ++i) {
+			if (i != 0)
+				g_string_append(sql, ", ");
+			g_string_append(sql, "?");
+		}
+		g_string_append(sql, ");");
+	}
+
+	ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
 	if (ret == SQLITE_OK) {
 		for (i = 0; i < n_values; ++i)
-			bind_sql_param(stmt, i + 1, &values[i]);
-		sqlite3_bind_int64(stmt, i + 1, g_value_get_int64(&rowid_val));
+			bind_column_param(sql_store, stmt, i + 1, columns[i], &values[i]);
+		if (priv->order_column != NULL)
+			sqlite3_bind_double(stmt, n_values + 1, order_key);
+	}
+
+	if (ret == SQLITE_OK)
+		ret = sqlite3_step(stmt);
+
+	if (ret == SQLITE_DONE) {
+		gtk_sql_store_sync_changes(sql_store, changes, 1);
+		gtk_sql_store_append_cached_row(sql_store, iter,
+			sqlite3_last_insert_rowid(priv->db),
+			columns, values, n_values, order_key);
+	} else {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	}
+
+	g_string_free(sql, TRUE);
+	sqlite3_finalize(stmt);
+}
+
+void gtk_sql_store_set_key_column(GtkSqlStore *sql_store,
+                                  gint column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	g_return_if_fail(column >= -1 && column < priv->n_columns);
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+	if (priv->shards != NULL) {
+		g_warning("GtkSqlStore over shards cannot have a key column");
+		return;
+	}
+
+	priv->key_column = column;
+	if (column >= 0)
+		gtk_sql_store_ensure_index(sql_store, -1, priv->columns[column], TRUE);
+}
+
+void gtk_sql_store_upsertv(GtkSqlStore *sql_store,
+                           gint *columns,
+                           GValue *values,
+                           gint n_columns,
+                           gint n_rows)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GString *sql;
+	sqlite3_stmt *stmt;
+	GArray *rowids;
+	GHashTable *batch;
+	GtkTreeIter *iters;
+	GtkTreeIter iter;
+	gboolean *found;
+	gboolean valid;
+	gboolean has_key = FALSE;
+	gboolean first = TRUE;
+	gdouble order_key;
+	gint changes = sqlite3_total_changes(priv->db);
+	gint n_missing = 0;
+	int i;
+	int row;
+	int ret;
+
+	for (i = 0; i < n_columns; ++i)
+		g_return_if_fail(columns[i] >= 0 && columns[i] < priv->n_columns);
+
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
+	gtk_sql_store_ensure_loaded(sql_store);
+
+	for (i = 0; i < n_columns; ++i)
+		has_key = has_key || columns[i] == priv->key_column;
+	if (priv->key_column < 0 || !has_key) {
+		g_warning("GtkSqlStore upsert needs the key column");
+		return;
+	}
+
+	if (n_rows <= 0)
+		return;
+
+	sql = g_string_new("");
+	g_string_printf(sql, "INSERT INTO \"%s\"(", priv->table);
+	for (i = 0; i < n_columns; ++i) {
+		if (i != 0)
+			g_string_append(sql, ", ");
+		g_string_append_printf(sql, "\"%s\"", priv->columns[columns[i]]);
+	}
+	if (priv->order_column != NULL)
+		g_string_append_printf(sql, ", \"%s\"", priv->order_column);
+	g_string_append(sql, ") VALUES (");
+	for (i = 0; i < n_columns + (priv->order_column != NULL); ++i) {
+		if (i != 0)
+			g_string_append(sql, ", ");
+		g_string_append(sql, "?");
+	}
+	g_string_append_printf(sql, ") ON CONFLICT(\"%s\") DO UPDATE SET ",
+		priv->columns[priv->key_column]);
+	/* existing rows keep their order key, a key-only upsert still has
+	 * to touch the row to return it */
+	for (i = 0; i < n_columns; ++i) {
+		if (columns[i] == priv->key_column && n_columns > 1)
+			continue;
+		g_string_append_printf(sql, "%s\"%s\" = excluded.\"%s\"",
+			first ? "" : ", ",
+			priv->columns[columns[i]], priv->columns[columns[i]]);
+		first = FALSE;
+	}
+	g_string_append(sql, " RETURNING _ROWID_;");
+
+	ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
+	g_string_free(sql, TRUE);
+
+	if (ret != SQLITE_OK || !gtk_sql_store_exec(sql_store, "SAVEPOINT gtk_sql_store;")) {
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+		sqlite3_finalize(stmt);
+		return;
+	}
+
+	rowids = g_array_sized_new(FALSE, FALSE, sizeof(gint64), n_rows);
+	order_key = gtk_sql_store_next_order_key(sql_store);
+
+	for (row = 0; row < n_rows && ret == SQLITE_OK; ++row) {
+		GValue *row_values = &values[row * n_columns];
+
+		for (i = 0; i < n_columns; ++i)
+			bind_column_param(sql_store, stmt, i + 1, columns[i], &row_values[i]);
+		if (priv->order_column != NULL)
+			sqlite3_bind_double(stmt, n_columns + 1, order_key + row * ORDER_KEY_GAP);
+
+		ret = sqlite3_step(stmt);
+		if (ret == SQLITE_ROW) {
+			gint64 rowid = sqlite3_column_int64(stmt, 0);
+			g_array_append_val(rowids, rowid);
+			ret = sqlite3_step(stmt);
+		}
+		ret = ret == SQLITE_DONE ? SQLITE_OK : ret;
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_OK)
+		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	if (ret != SQLITE_OK || !gtk_sql_store_exec(sql_store, "RELEASE gtk_sql_store;")) {
+		gtk_sql_store_exec(sql_store, "ROLLBACK TO gtk_sql_store; RELEASE gtk_sql_store;");
+		g_array_free(rowids, TRUE);
+		return;
+	}
+	gtk_sql_store_sync_changes(sql_store, changes, n_rows);
+
+	/* index the batch rather than the cache, one pass then finds the
+	 * cached rows it touched; the same key may come twice in a batch */
+	batch = g_hash_table_new(g_int64_hash, g_int64_equal);
+	for (row = 0; row < (int)rowids->len; ++row) {
+		gint64 *rowid = &g_array_index(rowids, gint64, row);
+
+		if (g_hash_table_lookup(batch, rowid) == NULL) {
+			g_hash_table_insert(batch, rowid, GINT_TO_POINTER(row + 1));
+			++n_missing;
+		}
+	}
+	iters = g_new(GtkTreeIter, rowids->len);
+	found = g_new0(gboolean, rowids->len);
+
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid && n_missing > 0) {
+		gint64 rowid;
+		gint pos;
+
+		gtk_tree_model_get((GtkTreeModel *)priv->store, &iter, 0, &rowid, -1);
+		pos = GPOINTER_TO_INT(g_hash_table_lookup(batch, &rowid)) - 1;
+		if (pos >= 0 && !found[pos]) {
+			iters[pos] = iter;
+			found[pos] = TRUE;
+			--n_missing;
+		}
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
 	}
 
-	if (ret == SQLITE_OK)
-		ret = sqlite3_step(stmt);
+	for (row = 0; row < (int)rowids->len; ++row) {
+		gint64 rowid = g_array_index(rowids, gint64, row);
+		GValue *row_values = &values[row * n_columns];
+		gint pos = GPOINTER_TO_INT(g_hash_table_lookup(batch, &rowid)) - 1;
+
+		if (found[pos]) {
+			GtkTreePath *path;
+
+			gtk_sql_store_set_cached_values(sql_store, &iters[pos], columns, row_values, n_columns);
+			path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, &iters[pos]);
+			gtk_tree_model_row_changed((GtkTreeModel *)sql_store, path, &iters[pos]);
+			gtk_tree_path_free(path);
+		} else {
+			gtk_sql_store_append_cached_row(sql_store, &iters[pos], rowid,
+				columns, row_values, n_columns, order_key + row * ORDER_KEY_GAP);
+			found[pos] = TRUE;
+		}
+	}
 
-	if (ret == SQLITE_DONE) {
-		GArray *sub_columns = g_array_sized_new(FALSE, FALSE, sizeof(gint), n_values);
+	g_hash_table_destroy(batch);
+	g_free(iters);
+	g_free(found);
+	g_array_free(rowids, TRUE);
+}
 
-		g_array_append_vals(sub_columns, columns, n_values);
-		for (i = 0; i < n_values; ++i)
-			++g_array_index(sub_columns, gint, i);
+void gtk_sql_store_clear(GtkSqlStore *sql_store)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gchar *sql;
+	gint changes = sqlite3_total_changes(priv->db);
+	gint n_rows;
+	gboolean ok = TRUE;
+	int i;
 
-		gtk_list_store_set_valuesv(priv->store, iter,
-			&g_array_index(sub_columns, gint, 0),
-			&g_array_index(values, GValue, 0),
-			n_values);
+	if (!gtk_sql_store_check_writable(sql_store))
+		return;
 
-		g_array_free(sub_columns, TRUE);
-	} else {
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	if (!gtk_sql_store_exec(sql_store, "SAVEPOINT gtk_sql_store;"))
+		return;
+
+	for (i = 0; i < gtk_sql_store_n_tables(sql_store) && ok; ++i) {
+		gchar *table = gtk_sql_store_table_name(sql_store, gtk_sql_store_nth_table(sql_store, i));
+
+		sql = g_strdup_printf("DELETE FROM %s;", table);
+		ok = gtk_sql_store_exec(sql_store, sql);
+		g_free(sql);
+		g_free(table);
 	}
 
-	g_string_free(sql, TRUE);
-	sqlite3_finalize(stmt);
+	/* a shard that could not be emptied keeps all of them */
+	if (!ok || !gtk_sql_store_exec(sql_store, "RELEASE gtk_sql_store;")) {
+		gtk_sql_store_exec(sql_store, "ROLLBACK TO gtk_sql_store; RELEASE gtk_sql_store;");
+		return;
+	}
 
-	{
-		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, iter);
-		gtk_tree_model_row_changed((GtkTreeModel *)sql_store, path, iter);
-		gtk_tree_path_free(path);
+	/* never loaded means nobody saw a row, the empty cache is current
+	 * unless an open transaction may still bring the rows back */
+	if (priv->needs_load) {
+		priv->loaded = TRUE;
+		priv->needs_load = FALSE;
+		priv->follow_valid = FALSE;
+		priv->data_version = gtk_sql_store_query_pragma(sql_store, "data_version");
+		priv->schema_version = gtk_sql_store_query_pragma(sql_store, "schema_version");
+		priv->total_changes = sqlite3_get_autocommit(priv->db) ?
+			sqlite3_total_changes(priv->db) : changes;
+		return;
 	}
+
+	n_rows = gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
+	gtk_sql_store_clear_cache(sql_store);
+	gtk_sql_store_sync_changes(sql_store, changes, n_rows);
 }
 
-void gtk_sql_store_remove(GtkSqlStore *sql_store,
-                          GtkTreeIter *iter)
+gboolean gtk_sql_store_iter_is_valid(GtkSqlStore *sql_store,
+                                     GtkTreeIter *iter)
 {
 	GtkSqlStorePrivate *priv = sql_store->priv;
-	GValue row_id = G_VALUE_INIT;
-	gchar *sql;
-	sqlite3_stmt *stmt;
-	int ret;
+	return gtk_list_store_iter_is_valid(priv->store, iter);
+}
 
-	gtk_tree_model_get_value((GtkTreeModel *)priv->store, iter, 0, &row_id);
+#define SNAPSHOT_MAGIC "GSQLSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_NULL G_MAXUINT32
 
-	sql = g_strdup_printf("DELETE FROM \"%s\" WHERE _ROWID_ = ?;", priv->table);
-	ret = sqlite3_prepare_v2(priv->db, sql, -1, &stmt, NULL);
-	g_free(sql);
+/* the rows follow the header and the layout string, every cell is stored
+ * in host byte order at the size of its column type; strings and blobs
+ * are length-prefixed and strings keep their NUL.  Loading decodes every
+ * row into the cache in one go, the mapping is released afterwards */
+typedef struct
+{
+	gchar magic[8];
+	guint32 version;
+	guint32 byte_order;
+	gint64 schema_version;
+	gint64 db_size;
+	gint64 db_mtime;
+	guint32 change_counter;
+	guint32 layout_len;
+	guint64 n_rows;
+} GtkSqlStoreSnapshotHeader;
+
+static gboolean gtk_sql_store_read_file_stamp(GtkSqlStore *sql_store,
+                                              GtkSqlStoreSnapshotHeader *header)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	const gchar *filename = sqlite3_db_filename(priv->db, "main");
+	gchar *wal_filename;
+	GStatBuf wal_stat;
+	gboolean wal_pending;
+	GFile *file;
+	GFileInfo *info;
+	FILE *fp;
+	guchar counter[4];
+	gboolean ok;
+
+	if (filename == NULL || *filename == '\0')
+		return FALSE;
+
+	/* commits still sitting in the WAL do not show in the main file */
+	wal_filename = g_strconcat(filename, "-wal", NULL);
+	wal_pending = g_stat(wal_filename, &wal_stat) == 0 && wal_stat.st_size > 0;
+	g_free(wal_filename);
+	if (wal_pending)
+		return FALSE;
+
+	file = g_file_new_for_path(filename);
+	info = g_file_query_info(file,
+		G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+		G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+		G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	g_object_unref(file);
+	if (info == NULL)
+		return FALSE;
+
+	header->db_size = g_file_info_get_size(info);
+	header->db_mtime =
+		g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+		g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+	g_object_unref(info);
+
+	/* file change counter, big-endian at offset 24 of the database header */
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return FALSE;
+	ok = fseek(fp, 24, SEEK_SET) == 0 && fread(counter, 1, 4, fp) == 4;
+	fclose(fp);
+	if (!ok)
+		return FALSE;
+
+	header->change_counter = (guint32)counter[0] << 24 | (guint32)counter[1] << 16 |
+		(guint32)counter[2] << 8 | (guint32)counter[3];
+	header->schema_version = query_pragma_int64(priv->db, "schema_version");
+
+	return TRUE;
+}
 
-	if (ret == SQLITE_OK) {
-		sqlite3_bind_int64(stmt, 1, g_value_get_int64(&row_id));
-		ret = sqlite3_step(stmt);
+static gboolean snapshot_type_supported(GType type)
+{
+	switch (G_TYPE_FUNDAMENTAL(type)) {
+	case G_TYPE_BOOLEAN:
+	case G_TYPE_INT:
+	case G_TYPE_UINT:
+	case G_TYPE_INT64:
+	case G_TYPE_UINT64:
+	case G_TYPE_DOUBLE:
+	case G_TYPE_STRING:
+		return TRUE;
+	default:
+		return type == G_TYPE_BYTES;
 	}
+}
 
-	if (ret == SQLITE_DONE) {
-		gtk_list_store_remove(priv->store, iter);
-	} else {
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
-	}
+/* rendered display strings depend on code, not data, and are left out */
+static gboolean gtk_sql_store_is_display_cache(GtkSqlStore *sql_store,
+                                               gint column)
+{
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	guint d;
 
-	sqlite3_finalize(stmt);
-	g_value_unset(&row_id);
+	for (d = 0; d < priv->displays->len; ++d)
+		if (g_array_index(priv->displays, GtkSqlStoreDisplay, d).cache_column == column)
+			return TRUE;
 
-	{
-		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, iter);
-		gtk_tree_model_row_deleted((GtkTreeModel *)sql_store, path);
-		gtk_tree_path_free(path);
-	}
+	return FALSE;
 }
 
-void gtk_sql_store_insert(GtkSqlStore *sql_store,
-                          GtkTreeIter *iter)
+static gchar *gtk_sql_store_snapshot_layout(GtkSqlStore *sql_store)
 {
-	gtk_sql_store_insert_with_valuesv(sql_store, iter, NULL, NULL, 0);
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	gint n_store_columns = gtk_tree_model_get_n_columns((GtkTreeModel *)priv->store);
+	GString *layout;
+	int i;
+
+	layout = g_string_new(priv->table);
+	for (i = 0; i < n_store_columns; ++i) {
+		GType type = gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, i);
+
+		if (gtk_sql_store_is_display_cache(sql_store, i))
+			continue;
+		if (!snapshot_type_supported(type)) {
+			g_warning("cannot snapshot column type %s", g_type_name(type));
+			g_string_free(layout, TRUE);
+			return NULL;
+		}
+
+		g_string_append_printf(layout, "\n%s:%s",
+			i >= 1 && i <= priv->n_columns ? priv->columns[i - 1] :
+			i == priv->order_cache_column ? priv->order_column : "",
+			g_type_name(type));
+	}
+
+	return g_string_free(layout, FALSE);
 }
 
-void gtk_sql_store_insert_with_values(GtkSqlStore *sql_store,
-                                      GtkTreeIter *iter,
-                                      ...)
+static void snapshot_write_data(GString *data, gconstpointer bytes, gsize size)
 {
-	GArray *columns;
-	GArray *values;
-	gint n_values;
-	va_list ap;
+	guint32 len = bytes != NULL ? size : SNAPSHOT_NULL;
 
-	columns = g_array_new(FALSE, FALSE, sizeof(gint));
-	values = g_array_new(FALSE, TRUE, sizeof(GValue));
+	g_string_append_len(data, (const gchar *)&len, sizeof(len));
+	if (bytes != NULL)
+		g_string_append_len(data, bytes, size);
+}
 
-	va_start(ap, iter);
-	for (n_values = 0; ; ++n_values) {
-		gint col = va_arg(ap, gint);
-		GValue val;
-		GType type;
+static void snapshot_write_value(GString *data, const GValue *value)
+{
+	GType type = G_VALUE_TYPE(value);
 
-		if (col < 0)
-			break;
+	if (type == G_TYPE_BYTES) {
+		GBytes *bytes = g_value_get_boxed(value);
+		gconstpointer p = NULL;
+		gsize size = 0;
 
-		type = gtk_sql_store_get_column_type((GtkTreeModel *)sql_store, col);
-		val = arg_to_value(&ap, type);
+		if (bytes != NULL) {
+			p = g_bytes_get_data(bytes, &size);
+			if (p == NULL)
+				p = "";
+		}
+		snapshot_write_data(data, p, size);
+		return;
+	}
 
-		g_array_append_val(columns, col);
-		g_array_append_val(values, val);
+	switch (G_TYPE_FUNDAMENTAL(type)) {
+	case G_TYPE_BOOLEAN: {
+		gint32 v = g_value_get_boolean(value);
+		g_string_append_len(data, (const gchar *)&v, sizeof(v));
+		break;
 	}
-	va_end(ap);
+	case G_TYPE_INT: {
+		gint32 v = g_value_get_int(value);
+		g_string_append_len(data, (const gchar *)&v, sizeof(v));
+		break;
+	}
+	case G_TYPE_UINT: {
+		guint32 v = g_value_get_uint(value);
+		g_string_append_len(data, (const gchar *)&v, sizeof(v));
+		break;
+	}
+	case G_TYPE_INT64: {
+		gint64 v = g_value_get_int64(value);
+		g_string_append_len(data, (const gchar *)&v, sizeof(v));
+		break;
+	}
+	case G_TYPE_UINT64: {
+		guint64 v = g_value_get_uint64(value);
+		g_string_append_len(data, (const gchar *)&v, sizeof(v));
+		break;
+	}
+	case G_TYPE_DOUBLE: {
+		gdouble v = g_value_get_double(value);
+		g_string_append_len(data, (const gchar *)&v, sizeof(v));
+		break;
+	}
+	case G_TYPE_STRING: {
+		const gchar *str = g_value_get_string(value);
+		snapshot_write_data(data, str, str != NULL ? strlen(str) : 0);
+		if (str != NULL)
+			g_string_append_c(data, '\0');
+		break;
+	}
+	default:
+		g_assert_not_reached();
+	}
+}
 
-	gtk_sql_store_insert_with_valuesv(sql_store,
-		iter,
-		&g_array_index(columns, gint, 0),
-		&g_array_index(values, GValue, 0),
-		n_values);
+static gboolean snapshot_read_value(const gchar **p,
+                                    const gchar *end,
+                                    GValue *value)
+{
+	GType type = G_VALUE_TYPE(value);
+	gsize size;
+
+	if (type == G_TYPE_BYTES || G_TYPE_FUNDAMENTAL(type) == G_TYPE_STRING) {
+		guint32 len;
+
+		if (end - *p < (gssize)sizeof(len))
+			return FALSE;
+		memcpy(&len, *p, sizeof(len));
+		*p += sizeof(len);
+
+		if (len == SNAPSHOT_NULL) {
+			if (type == G_TYPE_BYTES)
+				g_value_set_boxed(value, NULL);
+			else
+				g_value_set_string(value, NULL);
+			return TRUE;
+		}
 
-	while (n_values--)
-		g_value_unset(&g_array_index(values, GValue, n_values));
+		size = type == G_TYPE_BYTES ? len : (gsize)len + 1;
+		if ((gsize)(end - *p) < size)
+			return FALSE;
 
-	g_array_free(columns, TRUE);
-	g_array_free(values, TRUE);
+		if (type == G_TYPE_BYTES)
+			g_value_take_boxed(value, g_bytes_new(*p, len));
+		else
+			g_value_set_string(value, *p);
+		*p += size;
+		return TRUE;
+	}
+
+	switch (G_TYPE_FUNDAMENTAL(type)) {
+	case G_TYPE_BOOLEAN:
+	case G_TYPE_INT:
+	case G_TYPE_UINT:
+		size = 4;
+		break;
+	default:
+		size = 8;
+		break;
+	}
+	if ((gsize)(end - *p) < size)
+		return FALSE;
+
+	switch (G_TYPE_FUNDAMENTAL(type)) {
+	case G_TYPE_BOOLEAN: {
+		gint32 v;
+		memcpy(&v, *p, size);
+		g_value_set_boolean(value, v);
+		break;
+	}
+	case G_TYPE_INT: {
+		gint32 v;
+		memcpy(&v, *p, size);
+		g_value_set_int(value, v);
+		break;
+	}
+	case G_TYPE_UINT: {
+		guint32 v;
+		memcpy(&v, *p, size);
+		g_value_set_uint(value, v);
+		break;
+	}
+	case G_TYPE_INT64: {
+		gint64 v;
+		memcpy(&v, *p, size);
+		g_value_set_int64(value, v);
+		break;
+	}
+	case G_TYPE_UINT64: {
+		guint64 v;
+		memcpy(&v, *p, size);
+		g_value_set_uint64(value, v);
+		break;
+	}
+	case G_TYPE_DOUBLE: {
+		gdouble v;
+		memcpy(&v, *p, size);
+		g_value_set_double(value, v);
+		break;
+	}
+	default:
+		return FALSE;
+	}
+	*p += size;
+
+	return TRUE;
 }
 
-void gtk_sql_store_insert_with_valuesv(GtkSqlStore *sql_store,
-                                       GtkTreeIter *iter,
-                                       gint *columns,
-                                       GValue *values,
-                                       gint n_values)
+gboolean gtk_sql_store_save_snapshot(GtkSqlStore *sql_store,
+                                     const gchar *filename)
 {
 	GtkSqlStorePrivate *priv = sql_store->priv;
-	GString *sql;
-	sqlite3_stmt *stmt;
+	GtkSqlStoreSnapshotHeader header;
+	GtkSqlStoreSnapshotHeader check;
+	gint n_store_columns;
+	gchar *layout;
+	GString *data;
+	GtkTreeIter iter;
+	gboolean *skip;
+	gboolean valid;
+	GError *error = NULL;
 	int i;
-	int ret;
 
-	sql = g_string_new("");
-	g_string_printf(sql, "INSERT INTO \"%s\"(", priv->table);
-	for (i = 0; i < n_values; ++i) {
-		if (i != 0)
-			g_string_append(sql, ", ");
-		g_string_append_printf(sql, "\"%s\"", priv->columns[columns[i]]);
+	if (priv->query_stmt != NULL) {
+		g_warning("GtkSqlStore backed by a query cannot be snapshotted");
+		return FALSE;
 	}
-	g_string_append(sql, ") VALUES (");
-	for (i = 0; i < n_values; ++i) {
-		if (i != 0)
-			g_string_append(sql, ", ");
-		g_string_append(sql, "?");
+	if (priv->shards != NULL) {
+		g_warning("GtkSqlStore over shards cannot be snapshotted");
+		return FALSE;
 	}
-	g_string_append(sql, ");");
 
-	ret = sqlite3_prepare_v2(priv->db, sql->str, sql->len + 1, &stmt, NULL);
-	if (ret == SQLITE_OK) {
-		for (i = 0; i < n_values; ++i)
-			bind_sql_param(stmt, i + 1, &values[i]);
+	layout = gtk_sql_store_snapshot_layout(sql_store);
+	if (layout == NULL)
+		return FALSE;
+
+	/* move WAL content into the main file so the file stamp covers it */
+	gtk_sql_store_exec(sql_store, "PRAGMA wal_checkpoint(TRUNCATE);");
+
+	/* the cache must match the file both before and after bringing it
+	 * up to date, otherwise someone else wrote in between */
+	memset(&header, 0, sizeof(header));
+	memset(&check, 0, sizeof(check));
+	valid = gtk_sql_store_read_file_stamp(sql_store, &header);
+	if (valid) {
+		gtk_sql_store_requery_if_changed(sql_store);
+		valid = gtk_sql_store_read_file_stamp(sql_store, &check) &&
+			memcmp(&header, &check, sizeof(header)) == 0;
+	}
+	if (!valid) {
+		g_warning("cannot snapshot %s: database file is in use", priv->table);
+		g_free(layout);
+		return FALSE;
 	}
 
-	if (ret == SQLITE_OK)
-		ret = sqlite3_step(stmt);
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.layout_len = strlen(layout);
+	header.n_rows = gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
 
-	if (ret == SQLITE_DONE) {
-		GArray *sub_columns = g_array_sized_new(FALSE, FALSE, sizeof(gint), n_values + 1);
-		GArray *sub_values = g_array_sized_new(FALSE, FALSE, sizeof(GValue), n_values + 1);
-		gint rowid_col = 0;
-		GValue rowid_val = G_VALUE_INIT;
+	data = g_string_new_len((const gchar *)&header, sizeof(header));
+	g_string_append_len(data, layout, header.layout_len);
+	g_free(layout);
 
-		g_value_init(&rowid_val, G_TYPE_INT64);
-		g_value_set_int64(&rowid_val, sqlite3_last_insert_rowid(priv->db));
+	n_store_columns = gtk_tree_model_get_n_columns((GtkTreeModel *)priv->store);
+	skip = g_new0(gboolean, n_store_columns);
+	for (i = 0; i < n_store_columns; ++i)
+		skip[i] = gtk_sql_store_is_display_cache(sql_store, i);
 
-		g_array_append_val(sub_columns, rowid_col);
-		g_array_append_vals(sub_columns, columns, n_values);
-		for (i = 0; i < n_values; ++i)
-			++g_array_index(sub_columns, gint, i + 1);
+	valid = gtk_tree_model_get_iter_first((GtkTreeModel *)priv->store, &iter);
+	while (valid) {
+		for (i = 0; i < n_store_columns; ++i) {
+			GValue value = G_VALUE_INIT;
 
-		g_array_append_val(sub_values, rowid_val);
-		g_array_append_vals(sub_values, values, n_values);
+			if (skip[i])
+				continue;
 
-		gtk_list_store_insert_with_valuesv(priv->store, iter, -1,
-			&g_array_index(sub_columns, gint, 0),
-			&g_array_index(sub_values, GValue, 0),
-			n_values + 1);
+			gtk_tree_model_get_value((GtkTreeModel *)priv->store, &iter, i, &value);
+			snapshot_write_value(data, &value);
+			g_value_unset(&value);
+		}
+		valid = gtk_tree_model_iter_next((GtkTreeModel *)priv->store, &iter);
+	}
+	g_free(skip);
 
-		g_array_free(sub_columns, TRUE);
-		g_array_free(sub_values, TRUE);
-	} else {
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
+	valid = g_file_set_contents(filename, data->str, data->len, &error);
+	if (!valid) {
+		g_warning("Failed to write snapshot: %s", error->message);
+		g_error_free(error);
 	}
 
-	g_string_free(sql, TRUE);
-	sqlite3_finalize(stmt);
+	g_string_free(data, TRUE);
 
-	{
-		GtkTreePath *path = gtk_tree_model_get_path((GtkTreeModel *)priv->store, iter);
-		gtk_tree_model_row_inserted((GtkTreeModel *)sql_store, path, iter);
-		gtk_tree_path_free(path);
-	}
+	return valid;
 }
 
-void gtk_sql_store_clear(GtkSqlStore *sql_store)
+static gboolean gtk_sql_store_read_snapshot(GtkSqlStore *sql_store,
+                                            GMappedFile *mapped)
 {
 	GtkSqlStorePrivate *priv = sql_store->priv;
-	gchar *sql;
+	GtkSqlStoreSnapshotHeader header;
+	GtkSqlStoreSnapshotHeader current;
+	const gchar *p = g_mapped_file_get_contents(mapped);
+	const gchar *end = p + g_mapped_file_get_length(mapped);
+	gchar *layout;
+	gint n_store_columns;
+	gint n_cols;
+	gint *insert_columns;
+	GValue *insert_values;
+	guint64 row;
+	gboolean valid;
+	int i;
+
+	if ((gsize)(end - p) < sizeof(header))
+		return FALSE;
+	memcpy(&header, p, sizeof(header));
+	p += sizeof(header);
+
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != SNAPSHOT_VERSION ||
+	    header.byte_order != SNAPSHOT_BYTE_ORDER ||
+	    (gsize)(end - p) < header.layout_len)
+		return FALSE;
+
+	layout = gtk_sql_store_snapshot_layout(sql_store);
+	valid = layout != NULL &&
+		strlen(layout) == header.layout_len &&
+		memcmp(layout, p, header.layout_len) == 0;
+	g_free(layout);
+	if (!valid)
+		return FALSE;
+	p += header.layout_len;
+
+	/* stamp first, like gtk_sql_store_load() does */
+	priv->loaded = FALSE;
+	priv->needs_load = FALSE;
+	priv->follow_valid = FALSE;
+	priv->data_version = query_pragma_int64(priv->db, "data_version");
+	priv->schema_version = query_pragma_int64(priv->db, "schema_version");
+	priv->total_changes = sqlite3_total_changes(priv->db);
+
+	if (!gtk_sql_store_read_file_stamp(sql_store, &current) ||
+	    current.schema_version != header.schema_version ||
+	    current.db_size != header.db_size ||
+	    current.db_mtime != header.db_mtime ||
+	    current.change_counter != header.change_counter)
+		return FALSE;
+
+	n_store_columns = gtk_tree_model_get_n_columns((GtkTreeModel *)priv->store);
+	insert_columns = g_malloc(n_store_columns * sizeof(gint));
+	insert_values = g_malloc0(n_store_columns * sizeof(GValue));
+	n_cols = 0;
+	for (i = 0; i < n_store_columns; ++i) {
+		if (gtk_sql_store_is_display_cache(sql_store, i))
+			continue;
+		insert_columns[n_cols] = i;
+		g_value_init(&insert_values[n_cols++],
+			gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, i));
+	}
 
-	sql = g_strdup_printf("DELETE FROM \"%s\";", priv->table);
-	if (sqlite3_exec(priv->db, sql, NULL, NULL, NULL) != SQLITE_OK)
-		g_warning("SQLite error: %s", sqlite3_errmsg(priv->db));
-	g_free(sql);
 	gtk_list_store_clear(priv->store);
+
+	for (row = 0; valid && row < header.n_rows; ++row) {
+		for (i = 0; valid && i < n_cols; ++i)
+			valid = snapshot_read_value(&p, end, &insert_values[i]);
+
+		if (valid)
+			gtk_list_store_insert_with_valuesv(priv->store,
+				NULL,
+				-1,
+				insert_columns,
+				insert_values,
+				n_cols);
+	}
+
+	if (valid)
+		priv->loaded = TRUE;
+	else
+		gtk_list_store_clear(priv->store);
+
+	for (i = 0; i < n_cols; ++i)
+		g_value_unset(&insert_values[i]);
+
+	g_free(insert_columns);
+	g_free(insert_values);
+
+	return valid;
 }
 
-gboolean gtk_sql_store_iter_is_valid(GtkSqlStore *sql_store,
-                                     GtkTreeIter *iter)
+gboolean gtk_sql_store_load_snapshot(GtkSqlStore *sql_store,
+                                     const gchar *filename)
 {
 	GtkSqlStorePrivate *priv = sql_store->priv;
-	return gtk_list_store_iter_is_valid(priv->store, iter);
+	GMappedFile *mapped;
+	gboolean announce = !priv->needs_load;
+	gboolean valid = FALSE;
+
+	gtk_sql_store_clear_cache(sql_store);
+
+	if (priv->query_stmt == NULL && priv->shards == NULL) {
+		mapped = g_mapped_file_new(filename, FALSE, NULL);
+		if (mapped != NULL) {
+			valid = gtk_sql_store_read_snapshot(sql_store, mapped);
+			g_mapped_file_unref(mapped);
+		}
+	}
+
+	if (!valid)
+		gtk_sql_store_load(sql_store);
+	if (announce)
+		gtk_sql_store_announce_rows(sql_store);
+
+	return valid;
 }
 
 static GtkTreeModelFlags gtk_sql_store_get_flags(GtkTreeModel *tree_model)
@@ -725,7 +4318,7 @@ static gint gtk_sql_store_get_n_columns(GtkTreeModel *tree_model)
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
-	return priv->n_columns;
+	return priv->n_columns + priv->displays->len;
 }
 
 static GType gtk_sql_store_get_column_type(GtkTreeModel *tree_model,
@@ -733,6 +4326,8 @@ static GType gtk_sql_store_get_column_type(GtkTreeModel *tree_model,
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
+	if (index >= priv->n_columns)
+		return G_TYPE_STRING;
 	return gtk_tree_model_get_column_type((GtkTreeModel *)priv->store, index + 1);
 }
 
@@ -742,6 +4337,7 @@ static gboolean gtk_sql_store_get_iter(GtkTreeModel *tree_model,
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
+	gtk_sql_store_ensure_loaded(sql_store);
 	return gtk_tree_model_get_iter((GtkTreeModel *)priv->store, iter, path);
 }
 
@@ -760,6 +4356,14 @@ static void gtk_sql_store_get_value(GtkTreeModel *tree_model,
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
+	if (column >= priv->n_columns) {
+		gtk_sql_store_get_display_value(sql_store, iter, column - priv->n_columns, value);
+		return;
+	}
+	if (priv->fetched_columns[column] >= 0)
+		gtk_sql_store_fetch_deferred(sql_store, iter, column);
+	else if (priv->compressed_columns[column] >= 0)
+		gtk_sql_store_decompress(sql_store, iter, column);
 	gtk_tree_model_get_value((GtkTreeModel *)priv->store, iter, column + 1, value);
 }
 
@@ -785,6 +4389,7 @@ static gboolean gtk_sql_store_iter_children(GtkTreeModel *tree_model,
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
+	gtk_sql_store_ensure_loaded(sql_store);
 	return gtk_tree_model_iter_children((GtkTreeModel *)priv->store, iter, parent);
 }
 
@@ -801,6 +4406,7 @@ static gint gtk_sql_store_iter_n_children(GtkTreeModel *tree_model,
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
+	gtk_sql_store_ensure_loaded(sql_store);
 	return gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, iter);
 }
 
@@ -811,6 +4417,7 @@ static gboolean gtk_sql_store_iter_nth_child(GtkTreeModel *tree_model,
 {
 	GtkSqlStore *sql_store = (GtkSqlStore *)tree_model;
 	GtkSqlStorePrivate *priv = sql_store->priv;
+	gtk_sql_store_ensure_loaded(sql_store);
 	return gtk_tree_model_iter_nth_child((GtkTreeModel *)priv->store, iter, parent, n);
 }
 
@@ -839,3 +4446,82 @@ static void gtk_sql_store_unref_node(GtkTreeModel *tree_model,
 	return gtk_tree_model_unref_node((GtkTreeModel *)priv->store, iter);
 }
 
+static gboolean gtk_sql_store_row_draggable(GtkTreeDragSource *drag_source,
+                                            GtkTreePath *path)
+{
+	GtkSqlStore *sql_store = (GtkSqlStore *)drag_source;
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	return priv->order_column != NULL;
+}
+
+static gboolean gtk_sql_store_drag_data_get(GtkTreeDragSource *drag_source,
+                                            GtkTreePath *path,
+                                            GtkSelectionData *selection_data)
+{
+	return gtk_tree_set_row_drag_data(selection_data, (GtkTreeModel *)drag_source, path);
+}
+
+static gboolean gtk_sql_store_drag_data_delete(GtkTreeDragSource *drag_source,
+                                               GtkTreePath *path)
+{
+	GtkSqlStore *sql_store = (GtkSqlStore *)drag_source;
+	GtkSqlStorePrivate *priv = sql_store->priv;
+
+	/* drops onto ourselves were already done as a move, deleting the
+	 * source path now would hit whatever row moved into it */
+	if (priv->drag_moved) {
+		priv->drag_moved = FALSE;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean gtk_sql_store_row_drop_possible(GtkTreeDragDest *drag_dest,
+                                                GtkTreePath *dest_path,
+                                                GtkSelectionData *selection_data)
+{
+	GtkSqlStore *sql_store = (GtkSqlStore *)drag_dest;
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeModel *src_model = NULL;
+	GtkTreePath *src_path = NULL;
+	gboolean possible;
+
+	if (priv->order_column == NULL ||
+	    !gtk_tree_get_row_drag_data(selection_data, &src_model, &src_path))
+		return FALSE;
+
+	possible = src_model == (GtkTreeModel *)drag_dest &&
+		gtk_tree_path_get_depth(dest_path) == 1 &&
+		gtk_tree_path_get_indices(dest_path)[0] <=
+			gtk_tree_model_iter_n_children((GtkTreeModel *)priv->store, NULL);
+	gtk_tree_path_free(src_path);
+
+	return possible;
+}
+
+static gboolean gtk_sql_store_drag_data_received(GtkTreeDragDest *drag_dest,
+                                                 GtkTreePath *dest_path,
+                                                 GtkSelectionData *selection_data)
+{
+	GtkSqlStore *sql_store = (GtkSqlStore *)drag_dest;
+	GtkSqlStorePrivate *priv = sql_store->priv;
+	GtkTreeModel *src_model = NULL;
+	GtkTreePath *src_path = NULL;
+	GtkTreeIter src_iter;
+	gboolean moved = FALSE;
+
+	if (!gtk_sql_store_row_drop_possible(drag_dest, dest_path, selection_data) ||
+	    !gtk_tree_get_row_drag_data(selection_data, &src_model, &src_path))
+		return FALSE;
+
+	if (gtk_tree_model_get_iter((GtkTreeModel *)priv->store, &src_iter, src_path)) {
+		gtk_sql_store_move(sql_store, &src_iter, gtk_tree_path_get_indices(dest_path)[0]);
+		priv->drag_moved = TRUE;
+		moved = TRUE;
+	}
+	gtk_tree_path_free(src_path);
+
+	return moved;
+}
+
@@ -29,6 +29,30 @@ struct _GtkSqlStoreClass
   GObjectClass parent_class;
 };
 
+typedef enum
+{
+  GTK_SQL_STORE_COLUMN_NOT_NULL = 1 << 0,
+  GTK_SQL_STORE_COLUMN_UNIQUE   = 1 << 1,
+  GTK_SQL_STORE_COLUMN_INDEXED  = 1 << 2
+} GtkSqlStoreColumnFlags;
+
+typedef enum
+{
+  GTK_SQL_STORE_TABLE_STRICT    = 1 << 0
+} GtkSqlStoreTableFlags;
+
+typedef struct
+{
+  const gchar            *name;
+  GType                   type;
+  const gchar            *sql_type;
+  GtkSqlStoreColumnFlags  flags;
+} GtkSqlStoreColumn;
+
+typedef gchar *(*GtkSqlStoreDisplayFunc)        (GtkSqlStore   *sql_store,
+                                                 const GValue  *value,
+                                                 gpointer       user_data);
+
 GType           gtk_sql_store_get_type          (void) G_GNUC_CONST;
 GtkSqlStore    *gtk_sql_store_new               (sqlite3       *db,
                                                  const gchar   *table,
@@ -48,7 +72,71 @@ GtkSqlStore    *gtk_sql_store_new_with_filev    (const gchar   *filename,
                                                  gint           n_columns,
                                                  const gchar  **columns,
                                                  GType         *types);
+GtkSqlStore    *gtk_sql_store_new_full          (sqlite3       *db,
+                                                 const gchar   *table,
+                                                 GtkSqlStoreTableFlags flags,
+                                                 gint           n_columns,
+                                                 const GtkSqlStoreColumn *columns);
+GtkSqlStore    *gtk_sql_store_new_with_file_full(const gchar   *filename,
+                                                 const gchar   *table,
+                                                 GtkSqlStoreTableFlags flags,
+                                                 gint           n_columns,
+                                                 const GtkSqlStoreColumn *columns);
+GtkSqlStore    *gtk_sql_store_new_sharded       (const gchar  **filenames,
+                                                 gint           n_files,
+                                                 const gchar   *table,
+                                                 gint           n_columns,
+                                                 ...);
+GtkSqlStore    *gtk_sql_store_new_shardedv      (const gchar  **filenames,
+                                                 gint           n_files,
+                                                 const gchar   *table,
+                                                 gint           n_columns,
+                                                 const gchar  **columns,
+                                                 GType         *types);
+GtkSqlStore    *gtk_sql_store_new_sharded_full  (const gchar  **filenames,
+                                                 gint           n_files,
+                                                 const gchar   *table,
+                                                 GtkSqlStoreTableFlags flags,
+                                                 gint           n_columns,
+                                                 const GtkSqlStoreColumn *columns);
+gint            gtk_sql_store_attach_shard      (GtkSqlStore   *sql_store,
+                                                 const gchar   *filename);
+void            gtk_sql_store_detach_shard      (GtkSqlStore   *sql_store,
+                                                 gint           shard);
+void            gtk_sql_store_set_write_shard   (GtkSqlStore   *sql_store,
+                                                 gint           shard);
+void            gtk_sql_store_set_shard_sort_column(GtkSqlStore *sql_store,
+                                                 gint           column);
+gint            gtk_sql_store_get_shard         (GtkSqlStore   *sql_store,
+                                                 GtkTreeIter   *iter);
+GtkSqlStore    *gtk_sql_store_new_for_query     (sqlite3       *db,
+                                                 const gchar   *sql,
+                                                 GValue        *params,
+                                                 gint           n_params);
+void            gtk_sql_store_set_query_params  (GtkSqlStore   *sql_store,
+                                                 GValue        *params,
+                                                 gint           n_params);
 void            gtk_sql_store_requery           (GtkSqlStore   *sql_store);
+gboolean        gtk_sql_store_requery_if_changed(GtkSqlStore   *sql_store);
+void            gtk_sql_store_set_load_threads  (GtkSqlStore   *sql_store,
+                                                 gint           n_threads);
+void            gtk_sql_store_set_follow        (GtkSqlStore   *sql_store,
+                                                 guint          interval,
+                                                 gint           max_rows);
+void            gtk_sql_store_set_column_deferred(GtkSqlStore  *sql_store,
+                                                 gint           column,
+                                                 gboolean       deferred);
+void            gtk_sql_store_set_column_compressed(GtkSqlStore *sql_store,
+                                                 gint           column,
+                                                 gboolean       compressed);
+gint            gtk_sql_store_add_display_column(GtkSqlStore   *sql_store,
+                                                 gint           column,
+                                                 const gchar   *format);
+gint            gtk_sql_store_add_display_column_full(GtkSqlStore *sql_store,
+                                                 gint           column,
+                                                 GtkSqlStoreDisplayFunc func,
+                                                 gpointer       user_data,
+                                                 GDestroyNotify destroy);
 void            gtk_sql_store_set_value         (GtkSqlStore   *sql_store,
                                                  GtkTreeIter   *iter,
                                                  gint           column,
@@ -61,8 +149,28 @@ void            gtk_sql_store_set_valuesv       (GtkSqlStore   *sql_store,
                                                  gint          *columns,
                                                  GValue        *values,
                                                  gint           n_values);
+void            gtk_sql_store_update_where      (GtkSqlStore   *sql_store,
+                                                 const gchar   *predicate,
+                                                 ...);
+void            gtk_sql_store_update_wherev     (GtkSqlStore   *sql_store,
+                                                 gint          *columns,
+                                                 GValue        *values,
+                                                 gint           n_values,
+                                                 const gchar   *predicate,
+                                                 GValue        *params,
+                                                 gint           n_params);
 void            gtk_sql_store_remove            (GtkSqlStore   *sql_store,
                                                  GtkTreeIter   *iter);
+void            gtk_sql_store_remove_rows       (GtkSqlStore   *sql_store,
+                                                 GtkTreeIter   *iters,
+                                                 gint           n_iters);
+void            gtk_sql_store_remove_where      (GtkSqlStore   *sql_store,
+                                                 const gchar   *predicate,
+                                                 ...);
+void            gtk_sql_store_remove_wherev     (GtkSqlStore   *sql_store,
+                                                 const gchar   *predicate,
+                                                 GValue        *params,
+                                                 gint           n_params);
 void            gtk_sql_store_insert            (GtkSqlStore   *sql_store,
                                                  GtkTreeIter   *iter);
 void            gtk_sql_store_insert_with_values(GtkSqlStore   *sql_store,
@@ -73,9 +181,28 @@ void            gtk_sql_store_insert_with_valuesv(GtkSqlStore  *sql_store,
                                                  gint          *columns,
                                                  GValue        *values,
                                                  gint           n_values);
+void            gtk_sql_store_set_key_column    (GtkSqlStore   *sql_store,
+                                                 gint           column);
+void            gtk_sql_store_upsertv           (GtkSqlStore   *sql_store,
+                                                 gint          *columns,
+                                                 GValue        *values,
+                                                 gint           n_columns,
+                                                 gint           n_rows);
 void            gtk_sql_store_clear             (GtkSqlStore   *sql_store);
+void            gtk_sql_store_set_order_column  (GtkSqlStore   *sql_store,
+                                                 const gchar   *column);
+void            gtk_sql_store_move_before       (GtkSqlStore   *sql_store,
+                                                 GtkTreeIter   *iter,
+                                                 GtkTreeIter   *position);
+void            gtk_sql_store_move_after        (GtkSqlStore   *sql_store,
+                                                 GtkTreeIter   *iter,
+                                                 GtkTreeIter   *position);
 gboolean        gtk_sql_store_iter_is_valid     (GtkSqlStore   *sql_store,
                                                  GtkTreeIter   *iter);
+gboolean        gtk_sql_store_load_snapshot     (GtkSqlStore   *sql_store,
+                                                 const gchar   *filename);
+gboolean        gtk_sql_store_save_snapshot     (GtkSqlStore   *sql_store,
+                                                 const gchar   *filename);
 
 G_END_DECLS
 
@@ -15,6 +15,8 @@ GtkWidget *create_tree_view()
 		"col2", G_TYPE_INT,
 		"col3", G_TYPE_STRING);
 
+	gint col2_text = gtk_sql_store_add_display_column(store, 1, "%d");
+
 	if (gtk_tree_model_iter_n_children((GtkTreeModel *)store, NULL) == 0)
 		create_sample_data(store);
 
@@ -27,7 +29,7 @@ GtkWidget *create_tree_view()
 	column = gtk_tree_view_column_new_with_attributes("Column 1", renderer, "text", 0, NULL);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
 
-	column = gtk_tree_view_column_new_with_attributes("Column 2", renderer, "text", 1, NULL);
+	column = gtk_tree_view_column_new_with_attributes("Column 2", renderer, "text", col2_text, NULL);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
 
 	column = gtk_tree_view_column_new_with_attributes("Column 3", renderer, "text", 2, NULL);